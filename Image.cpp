@@ -0,0 +1,229 @@
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "Screen.cpp"
+
+#ifndef Image_cpp
+#define Image_cpp
+
+/*
+    image export of a Screen, for rendering without a terminal (see Window::OFFSCREEN)
+    only the colors are exported, glyphs are dropped except in the frame stream
+*/
+namespace Image {
+    enum class Format {
+        PPM, // binary netpbm (P6)
+        PNG, // 8 bit RGB, deflate stored blocks (no compression, no zlib needed)
+        RGB  // raw rows of r, g, b bytes, width and height are up to the caller
+    };
+
+    /* picks the format from the extension of path, anything unknown is raw RGB */
+    inline Format formatOf(const char* path){
+        const char* dot = strrchr(path, '.');
+        if (dot && (!strcmp(dot, ".png") || !strcmp(dot, ".PNG"))) return Format::PNG;
+        if (dot && (!strcmp(dot, ".ppm") || !strcmp(dot, ".PPM"))) return Format::PPM;
+        return Format::RGB;
+    }
+
+    namespace detail {
+        struct CrcTable {
+            uint32_t t[256];
+
+            constexpr CrcTable(): t() {
+                for (uint32_t i = 0; i < 256; ++i){
+                    uint32_t c = i;
+                    for (int k = 0; k < 8; ++k)
+                        c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                    t[i] = c;
+                }
+            }
+        };
+
+        static constexpr CrcTable CRC{};
+
+        inline uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size){
+            crc = ~crc;
+            for (size_t i = 0; i < size; ++i)
+                crc = CRC.t[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+            return ~crc;
+        }
+
+        inline void putBE32(std::vector<uint8_t>& out, uint32_t v){
+            const uint8_t bytes[4] = { (uint8_t)(v >> 24), (uint8_t)(v >> 16), (uint8_t)(v >> 8), (uint8_t)v };
+            out.insert(out.end(), bytes, bytes + 4);
+        }
+
+        inline void putLE16(std::vector<uint8_t>& out, uint16_t v){
+            out.push_back((uint8_t)v);
+            out.push_back((uint8_t)(v >> 8));
+        }
+
+        /* length, type, data, crc of type + data */
+        inline void putChunk(std::vector<uint8_t>& out, const char (&type)[5], const uint8_t* data, size_t size){
+            putBE32(out, (uint32_t)size);
+            const size_t start = out.size();
+            out.insert(out.end(), type, type + 4);
+            out.insert(out.end(), data, data + size);
+            putBE32(out, crc32(0, out.data() + start, out.size() - start));
+        }
+
+        inline void putRGB(std::vector<uint8_t>& out, const Screen& screen){
+            for (uint16_t y = 0; y < screen.height(); ++y){
+                const Pixel* row = screen.row(y);
+                for (uint16_t x = 0; x < screen.width(); ++x){
+                    out.push_back(row[x].r);
+                    out.push_back(row[x].g);
+                    out.push_back(row[x].b);
+                }
+            }
+        }
+
+        inline void putPNG(std::vector<uint8_t>& out, const Screen& screen){
+            static const uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+            out.insert(out.end(), SIGNATURE, SIGNATURE + 8);
+
+            std::vector<uint8_t> header;
+            putBE32(header, screen.width());
+            putBE32(header, screen.height());
+            header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 bit depth, truecolor, deflate, adaptive filters, no interlace
+            putChunk(out, "IHDR", header.data(), header.size());
+
+            // every row is prefixed with filter type 0 (none)
+            std::vector<uint8_t> raw;
+            raw.reserve((size_t)screen.height() * (3 * (size_t)screen.width() + 1));
+            for (uint16_t y = 0; y < screen.height(); ++y){
+                raw.push_back(0);
+                const Pixel* row = screen.row(y);
+                for (uint16_t x = 0; x < screen.width(); ++x){
+                    raw.push_back(row[x].r);
+                    raw.push_back(row[x].g);
+                    raw.push_back(row[x].b);
+                }
+            }
+
+            // zlib stream made of stored deflate blocks of at most 65535 bytes
+            constexpr size_t MAX_BLOCK = 65535;
+            std::vector<uint8_t> zlib = { 0x78, 0x01 };
+            size_t pos = 0;
+            do {
+                const size_t size = std::min(MAX_BLOCK, raw.size() - pos);
+                const bool last = pos + size == raw.size();
+
+                zlib.push_back(last ? 1 : 0);
+                putLE16(zlib, (uint16_t)size);
+                putLE16(zlib, (uint16_t)~size);
+                zlib.insert(zlib.end(), raw.begin() + pos, raw.begin() + pos + size);
+
+                pos += size;
+            } while (pos < raw.size());
+
+            uint32_t a = 1, b = 0; // adler32 of the uncompressed data
+            for (uint8_t v : raw){
+                a = (a + v) % 65521;
+                b = (b + a) % 65521;
+            }
+            putBE32(zlib, (b << 16) | a);
+
+            putChunk(out, "IDAT", zlib.data(), zlib.size());
+            putChunk(out, "IEND", nullptr, 0);
+        }
+    }
+
+    /* the whole file in memory */
+    inline std::vector<uint8_t> encode(const Screen& screen, Format format){
+        std::vector<uint8_t> out;
+
+        switch (format){
+            case Format::PPM: {
+                char header[32];
+                const int n = snprintf(header, sizeof(header), "P6\n%u %u\n255\n", screen.width(), screen.height());
+                out.insert(out.end(), header, header + n);
+                detail::putRGB(out, screen);
+                break;
+            }
+            case Format::PNG:
+                detail::putPNG(out, screen);
+                break;
+            case Format::RGB:
+                detail::putRGB(out, screen);
+                break;
+        }
+        return out;
+    }
+
+    inline bool write(const Screen& screen, Format format, int fd){
+        const std::vector<uint8_t> data = encode(screen, format);
+        return Screen::writeAll(fd, (const char*)data.data(), data.size());
+    }
+
+    /* returns false if the file could not be written */
+    inline bool save(const Screen& screen, const char* path){
+        FILE* file = fopen(path, "wb");
+        if (!file)
+            return false;
+
+        const std::vector<uint8_t> data = encode(screen, formatOf(path));
+        const bool written = fwrite(data.data(), 1, data.size(), file) == data.size();
+
+        return fclose(file) == 0 && written;
+    }
+}
+
+/* receives the finished frames of a Window instead of the terminal, see Window::setSink */
+class FrameSink {
+public:
+    virtual ~FrameSink() = default;
+    virtual void submit(const Screen& frame) = 0;
+};
+
+/*
+    writes every frame to a file descriptor in a compact binary format, for piping frames to other processes
+
+    every frame is a 12 byte header followed by the pixels, all numbers little endian:
+        "TFRM", uint16 width, uint16 height, uint32 size of the pixel data in bytes
+    the pixels are stored row-major as runs of equal pixels, 5 bytes per run:
+        uint8 length - 1, r, g, b, glyph
+*/
+class FrameStream : public FrameSink {
+private:
+    int fd;
+    std::vector<uint8_t> out;
+    bool failed = false;
+public:
+    explicit FrameStream(int fd): fd(fd) {}
+public:
+    void submit(const Screen& frame) override {
+        const Pixel* pixels = frame.data().data();
+        const size_t count = frame.data().size();
+
+        out.assign({ 'T', 'F', 'R', 'M' });
+        Image::detail::putLE16(out, frame.width());
+        Image::detail::putLE16(out, frame.height());
+        out.resize(12); // size is filled in below
+
+        for (size_t i = 0; i < count;){
+            const Pixel& p = pixels[i];
+            size_t run = 1;
+            while (run < 256 && i + run < count && pixels[i + run] == p)
+                ++run;
+
+            out.insert(out.end(), { (uint8_t)(run - 1), p.r, p.g, p.b, (uint8_t)p.c });
+            i += run;
+        }
+
+        const uint32_t size = (uint32_t)(out.size() - 12);
+        for (int k = 0; k < 4; ++k)
+            out[8 + k] = (uint8_t)(size >> (8 * k));
+
+        failed |= !Screen::writeAll(fd, (const char*)out.data(), out.size());
+    }
+
+    /* true once a frame could not be written completely */
+    bool hasFailed() const {
+        return failed;
+    }
+};
+
+#endif
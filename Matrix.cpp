@@ -0,0 +1,154 @@
+#include <cmath>
+#include <cstddef>
+
+#ifndef Matrix_cpp
+#define Matrix_cpp
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#   include <xmmintrin.h>
+#   define MATRIX_SSE
+#endif
+
+/*
+    4x4 row-major transform, points are column vectors so (A * B) applies B first
+    rotations follow the same directions as Renderer::rotateXAxis / rotateYAxis / rotateZAxis
+*/
+struct Mat4 {
+public:
+    float m[4][4];
+public:
+    float& operator() (int row, int col){ return m[row][col]; }
+    float operator() (int row, int col) const { return m[row][col]; }
+
+    static Mat4 identity(){
+        return {{
+            {1, 0, 0, 0},
+            {0, 1, 0, 0},
+            {0, 0, 1, 0},
+            {0, 0, 0, 1}
+        }};
+    }
+
+    static Mat4 translation(float x, float y, float z){
+        Mat4 res = identity();
+        res.m[0][3] = x;
+        res.m[1][3] = y;
+        res.m[2][3] = z;
+        return res;
+    }
+
+    static Mat4 scale(float x, float y, float z){
+        Mat4 res = identity();
+        res.m[0][0] = x;
+        res.m[1][1] = y;
+        res.m[2][2] = z;
+        return res;
+    }
+
+    static Mat4 rotationX(float angleInRadians){
+        const float c = cosf(angleInRadians), s = sinf(angleInRadians);
+        return {{
+            {1, 0,  0, 0},
+            {0, c, -s, 0},
+            {0, s,  c, 0},
+            {0, 0,  0, 1}
+        }};
+    }
+
+    static Mat4 rotationY(float angleInRadians){
+        const float c = cosf(angleInRadians), s = sinf(angleInRadians);
+        return {{
+            { c, 0, s, 0},
+            { 0, 1, 0, 0},
+            {-s, 0, c, 0},
+            { 0, 0, 0, 1}
+        }};
+    }
+
+    static Mat4 rotationZ(float angleInRadians){
+        const float c = cosf(angleInRadians), s = sinf(angleInRadians);
+        return {{
+            {c, -s, 0, 0},
+            {s,  c, 0, 0},
+            {0,  0, 1, 0},
+            {0,  0, 0, 1}
+        }};
+    }
+
+    Mat4 operator* (const Mat4& other) const {
+        Mat4 res;
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                res.m[i][j] = m[i][0] * other.m[0][j] + m[i][1] * other.m[1][j] + m[i][2] * other.m[2][j] + m[i][3] * other.m[3][j];
+        return res;
+    }
+
+    bool isIdentity() const {
+        for (int i = 0; i < 4; ++i)
+            for (int j = 0; j < 4; ++j)
+                if (m[i][j] != (i == j ? 1.0f : 0.0f))
+                    return false;
+        return true;
+    }
+
+    /*
+        upper bound of how much the transform can stretch a length, for growing bounding spheres
+        (square root of a Gershgorin bound on the largest eigenvalue of M^T M, exact for rotations times scales)
+    */
+    float maxScale() const {
+        float bound = 0.0f;
+        for (int i = 0; i < 3; ++i){
+            float row = 0.0f;
+            for (int j = 0; j < 3; ++j)
+                row += fabsf(m[0][i] * m[0][j] + m[1][i] * m[1][j] + m[2][i] * m[2][j]);
+            bound = fmaxf(bound, row);
+        }
+        return sqrtf(bound);
+    }
+
+    /* transforms the point in place, the bottom row is ignored (affine transforms only) */
+    void apply(float& x, float& y, float& z) const {
+        const float nx = m[0][0] * x + m[0][1] * y + m[0][2] * z + m[0][3];
+        const float ny = m[1][0] * x + m[1][1] * y + m[1][2] * z + m[1][3];
+        const float nz = m[2][0] * x + m[2][1] * y + m[2][2] * z + m[2][3];
+        x = nx; y = ny; z = nz;
+    }
+
+    /*
+        transforms count points in place, positions are given as separate x, y and z arrays
+        so 4 points can be transformed at once without shuffling
+    */
+    void apply(float* x, float* y, float* z, size_t count) const {
+        size_t i = 0;
+
+        #ifdef MATRIX_SSE
+            __m128 rows[3][4];
+            for (int r = 0; r < 3; ++r)
+                for (int c = 0; c < 4; ++c)
+                    rows[r][c] = _mm_set1_ps(m[r][c]);
+
+            for (; i + 4 <= count; i += 4){
+                const __m128 vx = _mm_loadu_ps(x + i);
+                const __m128 vy = _mm_loadu_ps(y + i);
+                const __m128 vz = _mm_loadu_ps(z + i);
+
+                __m128 res[3];
+                for (int r = 0; r < 3; ++r)
+                    res[r] = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+                        _mm_mul_ps(rows[r][0], vx),
+                        _mm_mul_ps(rows[r][1], vy)),
+                        _mm_mul_ps(rows[r][2], vz)),
+                        rows[r][3]);
+
+                _mm_storeu_ps(x + i, res[0]);
+                _mm_storeu_ps(y + i, res[1]);
+                _mm_storeu_ps(z + i, res[2]);
+            }
+        #endif
+
+        for (; i < count; ++i)
+            apply(x[i], y[i], z[i]);
+    }
+};
+
+#endif
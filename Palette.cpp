@@ -0,0 +1,141 @@
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#ifndef Palette_cpp
+#define Palette_cpp
+
+/*
+    quantization of 24 bit colors to the xterm 256 and 16 color palettes, for terminals without truecolor
+
+    colors are looked up in a 32x32x32 table (5 bits per channel) that holds the nearest palette entry,
+    so encoding a cell costs a shift and a load instead of a search over the palette
+*/
+namespace Palette {
+    enum class Mode : uint8_t {
+        TrueColor, // 38;2;r;g;b, exact
+        Xterm256,  // 38;5;n, 6x6x6 color cube and 24 grays
+        Ansi16     // 30-37 / 90-97, the colors the terminal theme picks for them
+    };
+
+    struct Rgb {
+        uint8_t r, g, b;
+    };
+
+    /* channel levels of the 6x6x6 cube, entries 16 to 231 */
+    static constexpr uint8_t CUBE[6] = { 0, 95, 135, 175, 215, 255 };
+
+    /* xterm defaults, themes move these around so they are only a best guess */
+    static constexpr Rgb ANSI[16] = {
+        {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0}, {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+        {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0}, {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255}
+    };
+
+    inline Rgb xterm(uint8_t index){
+        if (index < 16)
+            return ANSI[index];
+        if (index < 232){
+            const uint8_t i = index - 16;
+            return { CUBE[i / 36], CUBE[i / 6 % 6], CUBE[i % 6] };
+        }
+        const uint8_t gray = 8 + 10 * (index - 232);
+        return { gray, gray, gray };
+    }
+
+    constexpr int LUT_BITS = 5;
+    constexpr int LUT_SIZE = 1 << LUT_BITS;
+
+    class Table {
+    private:
+        uint8_t nearest[LUT_SIZE * LUT_SIZE * LUT_SIZE];
+    public:
+        /* first..last are the palette entries that may be picked */
+        Table(uint8_t first, uint8_t last){
+            for (int r = 0; r < LUT_SIZE; ++r)
+                for (int g = 0; g < LUT_SIZE; ++g)
+                    for (int b = 0; b < LUT_SIZE; ++b)
+                        nearest[index(r, g, b)] = search(center(r), center(g), center(b), first, last);
+        }
+    public:
+        uint8_t operator() (uint8_t r, uint8_t g, uint8_t b) const {
+            return nearest[index(r >> (8 - LUT_BITS), g >> (8 - LUT_BITS), b >> (8 - LUT_BITS))];
+        }
+    private:
+        static size_t index(int r, int g, int b){
+            return ((size_t)r << (2 * LUT_BITS)) | ((size_t)g << LUT_BITS) | (size_t)b;
+        }
+
+        /* middle of the range of colors that share a table entry */
+        static int center(int v){
+            return (v << (8 - LUT_BITS)) | (1 << (7 - LUT_BITS));
+        }
+
+        static uint8_t search(int r, int g, int b, uint8_t first, uint8_t last){
+            uint8_t best = first;
+            int bestDistance = INT32_MAX;
+
+            for (int i = first; i <= last; ++i){
+                const Rgb c = xterm((uint8_t)i);
+                const int dr = r - c.r, dg = g - c.g, db = b - c.b;
+                const int distance = dr * dr + dg * dg + db * db;
+
+                if (distance < bestDistance){
+                    bestDistance = distance;
+                    best = (uint8_t)i;
+                }
+            }
+            return best;
+        }
+    };
+
+    /*
+        the 16 colors of the 256 palette are left out, their actual colors depend on the theme
+        the tables are built on first use, 32 KiB each
+    */
+    inline const Table& table(Mode mode){
+        if (mode == Mode::Ansi16){
+            static const Table ansi(0, 15);
+            return ansi;
+        }
+        static const Table xterm256(16, 255);
+        return xterm256;
+    }
+
+    /*
+        4x4 ordered (Bayer) dithering, offsets in [-spread / 2, spread / 2) added to every channel
+        before the lookup so flat gradients turn into patterns instead of bands
+    */
+    class Dither {
+    private:
+        int8_t offsets[4][4];
+    public:
+        explicit Dither(int spread){
+            static constexpr uint8_t BAYER[4][4] = {
+                { 0,  8,  2, 10},
+                {12,  4, 14,  6},
+                { 3, 11,  1,  9},
+                {15,  7, 13,  5}
+            };
+
+            for (int y = 0; y < 4; ++y)
+                for (int x = 0; x < 4; ++x)
+                    offsets[y][x] = (int8_t)((BAYER[y][x] * 2 - 15) * spread / 32);
+        }
+    public:
+        uint8_t apply(uint8_t v, uint16_t x, uint16_t y) const {
+            return (uint8_t)std::clamp(v + offsets[y & 3][x & 3], 0, 255);
+        }
+    };
+
+    /* about the distance between neighbouring palette colors */
+    inline const Dither& dither(Mode mode){
+        if (mode == Mode::Ansi16){
+            static const Dither ansi(128);
+            return ansi;
+        }
+        static const Dither xterm256(40);
+        return xterm256;
+    }
+}
+
+#endif
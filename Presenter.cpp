@@ -0,0 +1,155 @@
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <vector>
+
+#include "Screen.cpp"
+
+#ifndef Presenter_cpp
+#define Presenter_cpp
+
+/*
+    presents frames on a separate thread so the caller can rasterize the next frame
+    while the previous one is being encoded and written to the terminal
+
+    frames are handed over through a lock-free triple buffer:
+    the caller fills one slot, the present thread reads another one,
+    and the third one holds the newest finished frame that has not been picked up yet
+*/
+class Presenter {
+public:
+    enum class Policy {
+        DropOldest, // submit never waits, a frame that was not picked up in time is replaced
+        BlockOnFull // submit waits until the present thread has picked up the previous frame
+    };
+private:
+    struct Frame {
+        uint16_t W = 0;
+        uint16_t H = 0;
+        std::vector<Pixel> pixels;
+    };
+
+    static constexpr uint8_t INDEX_MASK = 0b011;
+    static constexpr uint8_t FRESH = 0b100; // the middle slot holds a frame that was not presented yet
+
+    Frame slots[3];
+    std::atomic<uint8_t> middle{1}; // index of the middle slot | FRESH
+    uint8_t writeIndex = 0; // only touched by the caller
+    uint8_t readIndex = 2;  // only touched by the present thread
+
+    Policy policy;
+    Screen output; // owns the encoder state (output buffer, incremental front buffer)
+
+    std::atomic<bool> running{true};
+    std::atomic<bool> incremental{false};
+    std::atomic<Palette::Mode> colors{Palette::Mode::TrueColor};
+    std::atomic<bool> dither{false};
+    std::atomic<CellMode> cells{DEFAULT_CELL_MODE};
+    std::atomic<uint16_t> terminalColumns{0};
+    std::atomic<uint64_t> dropped{0};
+
+    std::thread thread;
+public:
+    /* frames are written to fd, a negative one only encodes them (see Screen::setOutput) */
+    Presenter(uint16_t W, uint16_t H, Policy policy, int fd = 1): policy(policy), output(W, H) {
+        output.setOutput(fd);
+        thread = std::thread(&Presenter::run, this);
+    }
+
+    /* the last submitted frame is still presented before the thread exits */
+    ~Presenter(){
+        running.store(false, std::memory_order_release);
+        thread.join();
+    }
+
+    Presenter(const Presenter&) = delete;
+    Presenter& operator= (const Presenter&) = delete;
+public:
+    /* copies the finished frame into the caller's slot and publishes it */
+    void submit(const Screen& screen){
+        Frame& frame = slots[writeIndex];
+        frame.W = screen.width();
+        frame.H = screen.height();
+        frame.pixels.assign(screen.data().begin(), screen.data().end());
+
+        if (policy == Policy::BlockOnFull)
+            while (middle.load(std::memory_order_acquire) & FRESH)
+                idle();
+
+        const uint8_t previous = middle.exchange(writeIndex | FRESH, std::memory_order_acq_rel);
+        writeIndex = previous & INDEX_MASK;
+
+        if (previous & FRESH)
+            dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void setIncremental(bool enable){
+        incremental.store(enable, std::memory_order_relaxed);
+    }
+
+    void setColorMode(Palette::Mode mode, bool dither){
+        colors.store(mode, std::memory_order_relaxed);
+        this->dither.store(dither, std::memory_order_relaxed);
+    }
+
+    void setCellMode(CellMode mode){
+        cells.store(mode, std::memory_order_relaxed);
+    }
+
+    void setTerminalColumns(uint16_t columns){
+        terminalColumns.store(columns, std::memory_order_relaxed);
+    }
+
+    /* number of frames that were replaced before they could be presented */
+    uint64_t droppedFrames() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    void run(){
+        bool isIncremental = false;
+
+        while (true){
+            if (!(middle.load(std::memory_order_acquire) & FRESH)){
+                if (!running.load(std::memory_order_acquire) && !(middle.load(std::memory_order_acquire) & FRESH))
+                    break;
+
+                idle();
+                continue;
+            }
+
+            const uint8_t previous = middle.exchange(readIndex, std::memory_order_acq_rel);
+            readIndex = previous & INDEX_MASK;
+
+            Frame& frame = slots[readIndex];
+
+            if (frame.W != output.width() || frame.H != output.height())
+                output.resize(frame.W, frame.H);
+
+            if (incremental.load(std::memory_order_relaxed) != isIncremental){
+                isIncremental = !isIncremental;
+                output.setIncremental(isIncremental);
+            }
+
+            const Palette::Mode mode = colors.load(std::memory_order_relaxed);
+            const bool dithered = dither.load(std::memory_order_relaxed) && mode != Palette::Mode::TrueColor;
+            if (mode != output.colorMode() || dithered != output.isDithered())
+                output.setColorMode(mode, dithered);
+
+            if (cells.load(std::memory_order_relaxed) != output.cellMode())
+                output.setCellMode(cells.load(std::memory_order_relaxed));
+
+            output.setTerminalColumns(terminalColumns.load(std::memory_order_relaxed));
+
+            output.data().swap(frame.pixels); // both buffers are owned by this thread right now
+            output.present();
+        }
+    }
+
+    /* frames arrive at most every few milliseconds, so back off instead of spinning a core */
+    static void idle(){
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+};
+
+#endif
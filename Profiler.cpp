@@ -0,0 +1,197 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#ifndef Profiler_cpp
+#define Profiler_cpp
+
+/*
+    uncomment to time the pipeline stages and count triangles, pixels and bytes every frame,
+    without it the PROFILE_ macros compile to nothing and the stats stay zero
+*/
+// #define USE_PROFILER
+
+/*
+    uncomment to also count the heap allocations of every frame (Counter::Allocations), works without USE_PROFILER,
+    it replaces the global operator new / delete, so it has to be defined in only one translation unit
+*/
+// #define USE_ALLOCATION_COUNTER
+
+/*
+    frame time profiler
+
+    PROFILE_SCOPE(Stage) times the rest of the enclosing block, scopes nest and only the innermost
+    one is charged, so the stage times of a frame add up to the time spent inside scopes,
+    PROFILE_COUNT(Counter, n) adds to a counter,
+    Window::refresh() closes the frame, its totals are then available through Profiler::lastFrame()
+
+    counters and times are atomic since rasterization (and presenting, see Window::setAsyncRefresh)
+    can happen on other threads, work done by the presenter thread lands in whatever frame is open
+*/
+namespace Profiler {
+    enum class Stage : uint8_t {
+        Transform,     // Mat4 applied to the vertices of a draw call
+        Projection,    // perspective divide into screen space
+        Culling,       // clipping and backface culling
+        Triangulation, // splitting polygons into triangles
+        Raster,        // lines, spans and triangles
+        Encode,        // Screen::present turning pixels into escape codes
+        Write,         // writing the escape codes to the terminal
+        Count
+    };
+
+    enum class Counter : uint8_t {
+        Triangles,   // triangles handed to a rasterizer
+        Pixels,      // pixels covered by the rasterizers, before depth testing
+        Bytes,       // bytes written to the terminal
+        Allocations, // calls to operator new, see USE_ALLOCATION_COUNTER
+        Count
+    };
+
+    constexpr size_t STAGES = (size_t)Stage::Count;
+    constexpr size_t COUNTERS = (size_t)Counter::Count;
+
+    inline const char* name(Stage stage){
+        static const char* const NAMES[STAGES] = {
+            "transform", "project", "cull", "triangulate", "raster", "encode", "write"
+        };
+        return NAMES[(size_t)stage];
+    }
+
+    inline const char* name(Counter counter){
+        static const char* const NAMES[COUNTERS] = { "triangles", "pixels", "bytes", "allocations" };
+        return NAMES[(size_t)counter];
+    }
+
+    struct FrameStats {
+        uint64_t frameNs = 0; // time since the previous frame was closed
+        uint64_t stageNs[STAGES] = {};
+        uint64_t counters[COUNTERS] = {};
+
+        double ms(Stage stage) const { return stageNs[(size_t)stage] / 1e6; }
+        double frameMs() const { return frameNs / 1e6; }
+        uint64_t count(Counter counter) const { return counters[(size_t)counter]; }
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    /* totals of the frame that is still open */
+    struct Accumulator {
+        std::atomic<uint64_t> stageNs[STAGES] = {};
+        std::atomic<uint64_t> counters[COUNTERS] = {};
+        Clock::time_point start = Clock::now();
+    };
+
+    inline Accumulator& current(){
+        static Accumulator accumulator;
+        return accumulator;
+    }
+
+    inline FrameStats& last(){
+        static FrameStats stats;
+        return stats;
+    }
+
+    inline void add(Stage stage, uint64_t ns){
+        current().stageNs[(size_t)stage].fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    inline void count(Counter counter, uint64_t n){
+        current().counters[(size_t)counter].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    /* moves the totals of the open frame into lastFrame() and starts a new one */
+    inline void endFrame(){
+        Accumulator& acc = current();
+        FrameStats& stats = last();
+        const Clock::time_point now = Clock::now();
+
+        stats.frameNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - acc.start).count();
+        acc.start = now;
+
+        for (size_t i = 0; i < STAGES; ++i)
+            stats.stageNs[i] = acc.stageNs[i].exchange(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < COUNTERS; ++i)
+            stats.counters[i] = acc.counters[i].exchange(0, std::memory_order_relaxed);
+    }
+
+    inline const FrameStats& lastFrame(){
+        return last();
+    }
+
+    /* charges the time until it goes out of scope to stage, pausing the scope it is nested in */
+    class Scope {
+    private:
+        Stage stage;
+        Scope* parent;
+        Clock::time_point start;
+
+        static Scope*& innermost(){
+            static thread_local Scope* scope = nullptr;
+            return scope;
+        }
+
+        static uint64_t since(Clock::time_point t, Clock::time_point now){
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(now - t).count();
+        }
+    public:
+        explicit Scope(Stage stage): stage(stage), parent(innermost()), start(Clock::now()) {
+            if (parent)
+                add(parent->stage, since(parent->start, start));
+            innermost() = this;
+        }
+
+        ~Scope(){
+            const Clock::time_point now = Clock::now();
+            add(stage, since(start, now));
+
+            innermost() = parent;
+            if (parent)
+                parent->start = now;
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator= (const Scope&) = delete;
+    };
+}
+
+#ifdef USE_ALLOCATION_COUNTER
+namespace Profiler {
+    /* the whole replaced operator new / delete family goes through this pair */
+    inline void* allocate(size_t size){
+        count(Counter::Allocations, 1);
+
+        if (void* p = malloc(size ? size : 1))
+            return p;
+        throw std::bad_alloc();
+    }
+
+    inline void deallocate(void* p) noexcept {
+        free(p);
+    }
+}
+
+void* operator new(size_t size){ return Profiler::allocate(size); }
+void* operator new[](size_t size){ return Profiler::allocate(size); }
+
+void operator delete(void* p) noexcept { Profiler::deallocate(p); }
+void operator delete[](void* p) noexcept { Profiler::deallocate(p); }
+void operator delete(void* p, size_t) noexcept { Profiler::deallocate(p); }
+void operator delete[](void* p, size_t) noexcept { Profiler::deallocate(p); }
+#endif
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef USE_PROFILER
+#   define PROFILE_SCOPE(stage) Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(Profiler::Stage::stage)
+#   define PROFILE_COUNT(counter, n) Profiler::count(Profiler::Counter::counter, (uint64_t)(n))
+#else
+#   define PROFILE_SCOPE(stage) ((void)0)
+#   define PROFILE_COUNT(counter, n) ((void)sizeof(n))
+#endif
+
+#endif
@@ -1,25 +1,32 @@
 #include "Window.cpp"
+#include "Matrix.cpp"
 #include <variant>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
 
 #ifndef Renderer_cpp
 #define Renderer_cpp
 
+/* the glyph sits next to the color so the struct packs into 10 bytes without padding */
 struct Point3d {
     uint8_t r, g, b;
-    int16_t x, y, z;
     char c;
+    int16_t x, y, z;
 
     Point3d(uint8_t r, uint8_t g, uint8_t b, int16_t x, int16_t y, int16_t z): 
-        r(r), g(g), b(b), x(x), y(y), z(z), c('@') {}
+        r(r), g(g), b(b), c('@'), x(x), y(y), z(z) {}
     
     Point3d(uint8_t r, uint8_t g, uint8_t b, int16_t x, int16_t y, int16_t z, char c): 
-        r(r), g(g), b(b), x(x), y(y), z(z), c(c) {}
+        r(r), g(g), b(b), c(c), x(x), y(y), z(z) {}
     
     Point3d(const Point3d& other) = default;
     ~Point3d() = default;
     Point3d() = default;
 };
 
+static_assert(sizeof(Point3d) == 10, "Point3d is expected to be packed");
+
 struct Edge3d {
 public:
     Point3d a, b;
@@ -59,33 +66,281 @@ public:
     auto end()   const { return points.end();   }
 };
 
+/* bounding sphere of a vertex buffer, used to skip whole objects that are out of view */
+struct Sphere {
+public:
+    float x = 0.0f, y = 0.0f, z = 0.0f;
+    float radius = -1.0f; // negative when there are no points
+
+    /* centered on the bounding box of the points, not the smallest sphere but close enough for culling */
+    static Sphere around(const Point3d* points, size_t count){
+        Sphere res;
+        if (!count) return res;
+
+        float min[3] = { (float)points[0].x, (float)points[0].y, (float)points[0].z };
+        float max[3] = { min[0], min[1], min[2] };
+
+        for (size_t i = 1; i < count; ++i){
+            const float p[3] = { (float)points[i].x, (float)points[i].y, (float)points[i].z };
+            for (int k = 0; k < 3; ++k){
+                min[k] = std::min(min[k], p[k]);
+                max[k] = std::max(max[k], p[k]);
+            }
+        }
+
+        res.x = (min[0] + max[0]) / 2;
+        res.y = (min[1] + max[1]) / 2;
+        res.z = (min[2] + max[2]) / 2;
+        res.radius = 0.0f;
+
+        for (size_t i = 0; i < count; ++i){
+            const float dx = points[i].x - res.x, dy = points[i].y - res.y, dz = points[i].z - res.z;
+            res.radius = std::max(res.radius, dx * dx + dy * dy + dz * dz);
+        }
+        res.radius = sqrtf(res.radius);
+
+        return res;
+    }
+};
+
+/*
+    triangle mesh with runtime sized buffers, every 3 indices form a triangle
+    unlike Obj3d and the index packs of renderTriObj, the shape does not have to be known at compile time
+*/
+struct Mesh {
+public:
+    std::vector<Point3d> vertices;
+    std::vector<uint32_t> indices;
+    Sphere bounds; // see updateBounds
+public:
+    Mesh() = default;
+    Mesh(std::vector<Point3d> vertices, std::vector<uint32_t> indices): vertices(std::move(vertices)), indices(std::move(indices)) {}
+
+    size_t triangleCount() const { return indices.size() / 3; }
+
+    /* call after changing the vertices, until then Renderer::draw works the bounds out on every call */
+    void updateBounds(){
+        bounds = Sphere::around(vertices.data(), vertices.size());
+    }
+
+public: /* index reordering */
+    /*
+        reorders the triangles so that consecutive triangles share vertices (tipsify, Sander et al. 2007),
+        cacheSize is the number of recently used vertices that are assumed to still be in cache
+    */
+    void optimizeVertexCache(uint32_t cacheSize = 16){
+        const uint32_t vertexCount = (uint32_t)vertices.size();
+        const size_t count = triangleCount();
+
+        // triangles with an index outside the vertex buffer are left out of the adjacency and never reached
+        std::vector<bool> emitted(count, false);
+        for (size_t i = 0; i < count; ++i)
+            for (uint32_t j = 0; j < 3; ++j)
+                if (indices[3 * i + j] >= vertexCount)
+                    emitted[i] = true;
+
+        // triangles around every vertex, offsets[v] to offsets[v + 1] in adjacent
+        std::vector<uint32_t> offsets(vertexCount + 1, 0);
+        for (size_t i = 0; i < 3 * count; ++i)
+            if (!emitted[i / 3])
+                ++offsets[indices[i] + 1];
+
+        for (uint32_t v = 0; v < vertexCount; ++v)
+            offsets[v + 1] += offsets[v];
+
+        std::vector<uint32_t> adjacent(offsets[vertexCount]);
+        std::vector<uint32_t> live(vertexCount, 0); // triangles around the vertex that were not emitted yet
+        for (size_t i = 0; i < 3 * count; ++i)
+            if (!emitted[i / 3])
+                adjacent[offsets[indices[i]] + live[indices[i]]++] = (uint32_t)(i / 3);
+
+        std::vector<uint32_t> cacheTime(vertexCount, 0);
+        std::vector<uint32_t> deadEnd;
+        std::vector<uint32_t> candidates;
+        std::vector<uint32_t> reordered;
+        reordered.reserve(indices.size());
+
+        uint32_t time = cacheSize + 1;
+        uint32_t cursor = 0;
+        int64_t fan = vertexCount ? 0 : -1;
+
+        while (fan >= 0){
+            candidates.clear();
+
+            // emit every remaining triangle around the fanning vertex
+            for (uint32_t k = offsets[fan]; k < offsets[fan + 1]; ++k){
+                const uint32_t tri = adjacent[k];
+                if (emitted[tri]) continue;
+
+                for (uint32_t j = 0; j < 3; ++j){
+                    const uint32_t v = indices[3 * tri + j];
+
+                    reordered.push_back(v);
+                    deadEnd.push_back(v);
+                    candidates.push_back(v);
+                    --live[v];
+
+                    if (time - cacheTime[v] > cacheSize)
+                        cacheTime[v] = time++;
+                }
+                emitted[tri] = true;
+            }
+
+            // next fanning vertex: the one that will stay in cache the longest and still has triangles left
+            fan = -1;
+            int64_t best = -1;
+            for (uint32_t v : candidates){
+                if (!live[v]) continue;
+
+                int64_t priority = 0;
+                if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+                    priority = time - cacheTime[v];
+
+                if (priority > best){
+                    best = priority;
+                    fan = v;
+                }
+            }
+
+            // dead end: go back to a recently used vertex, or the next one in order
+            while (fan < 0 && !deadEnd.empty()){
+                const uint32_t v = deadEnd.back();
+                deadEnd.pop_back();
+                if (live[v]) fan = v;
+            }
+
+            while (fan < 0 && cursor < vertexCount){
+                if (live[cursor]) fan = cursor;
+                ++cursor;
+            }
+        }
+
+        // triangles with an index outside the vertex buffer are kept at the end, unchanged
+        for (size_t i = 0; i < count; ++i)
+            for (uint32_t j = 0; j < 3; ++j)
+                if (indices[3 * i + j] >= vertexCount){
+                    reordered.insert(reordered.end(), indices.begin() + 3 * i, indices.begin() + 3 * i + 3);
+                    break;
+                }
+
+        indices.swap(reordered);
+    }
+
+    /* reorders the vertices by first use in the index buffer, so the projected vertices are read mostly in order */
+    void optimizeVertexFetch(){
+        const uint32_t unused = UINT32_MAX;
+        std::vector<uint32_t> remap(vertices.size(), unused);
+        std::vector<Point3d> reordered;
+        reordered.reserve(vertices.size());
+
+        for (uint32_t& i : indices){
+            if (i >= vertices.size()) continue;
+
+            if (remap[i] == unused){
+                remap[i] = (uint32_t)reordered.size();
+                reordered.push_back(vertices[i]);
+            }
+            i = remap[i];
+        }
+
+        // vertices no triangle uses go last
+        for (size_t v = 0; v < vertices.size(); ++v)
+            if (remap[v] == unused)
+                reordered.push_back(vertices[v]);
+
+        vertices.swap(reordered);
+    }
+};
+
 class Renderer {
+public: /* culling */
+    /* which faces are skipped, a face is front facing when its vertices go counter-clockwise on screen */
+    enum class Culling { None, Back, Front };
+
+    /* running totals, see cullStats */
+    struct CullStats {
+        uint64_t objects = 0;       // buffers and meshes drawn
+        uint64_t objectsCulled = 0; // skipped because their bounding sphere is out of view
+        uint64_t primitives = 0;    // points, edges, faces and triangles that reached the culling stage
+        uint64_t backfaces = 0;     // skipped because of their winding
+        uint64_t clipped = 0;       // cut by the near plane or the guard band
+        uint64_t behind = 0;        // entirely behind the near plane
+        uint64_t offscreen = 0;     // entirely outside the guard band
+    };
+
+    /* names a vertex buffer for the triangulation cache, see setTriangulationCache */
+    struct MeshKey {
+        uint32_t id;         // picked by the caller, one per buffer
+        uint32_t generation; // bumped by the caller whenever the vertices of the buffer change
+    };
 private:
     Window& window;
+    std::vector<Point2d> projected; // every vertex of the current draw call, projected once
+    std::vector<uint32_t> triangles; // indices into projected, 3 per triangle
+    std::vector<uint32_t> visible; // triangles left after culling, see cull
+
+    Mat4 transform = Mat4::identity();
+    bool hasTransform = false;
+    std::vector<float> xs, ys, zs; // transformed positions of the current draw call
+    const Point3d* source = nullptr; // buffer of the current draw call, for the colors of clipped vertices
+    std::vector<uint8_t> outcodes; // clip planes every vertex of the current draw call is outside of
+    bool anyOutside = false; // some vertex of the current draw call needs clipping
+
+    Culling culling = Culling::None;
+    CullStats stats;
+
+    /* triangles of a filled face, stored in cachedIndices as the face indices followed by 3 * (size - 2) triangle indices */
+    struct CachedFace {
+        MeshKey mesh;
+        uint32_t first, size;
+    };
+
+    static constexpr size_t DEFAULT_CACHED_FACES = 4096;
+
+    bool cacheTriangulations = false;
+    size_t maxCachedFaces = DEFAULT_CACHED_FACES;
+    bool cacheFaces = false; // the current draw call was given a MeshKey
+    MeshKey cacheMesh = {};
+    std::unordered_map<uint64_t, CachedFace> faceCache;
+    std::vector<uint32_t> cachedIndices;
+
+    // the eye sits at z = -50, points closer to it than this along the view axis are clipped away
+    static constexpr float NEAR_Z = -49.0f;
+    // points that project further than this from the middle of the screen are clipped away too,
+    // so every projected position fits a Point2d, the Window clips the rest to the screen
+    static constexpr float GUARD_BAND = 16000.0f;
+
+    static constexpr int CLIP_PLANES = 5; // near, left, right, top, bottom
+    static constexpr uint8_t REJECTED = 0xFF;
+    static constexpr uint32_t CLIPPED_VERTEX = UINT32_MAX;
+
+    /* a vertex while it is being clipped, index is where it is in projected or CLIPPED_VERTEX if clipping made it */
+    struct ClipVertex {
+        float x, y, z;
+        float r, g, b;
+        uint32_t index;
+    };
 public:
     Renderer(Window& window): window(window) {}
     ~Renderer() = default;
 public:
     void render(const Point3d& p){
-        window.drawPoint(project(p));
+        projectAll(&p, 1);
+        drawPoint(0);
     }
 
     void render(const Edge3d& e){
-        window.drawLine(
-            project(e.a),
-            project(e.b)
-        );
+        const Point3d points[2] = { e.a, e.b };
+
+        projectAll(points, 2);
+        drawSegment(0, 1);
     }
 
     template<size_t S>
     void render(const Face3d<S>& face, bool fill){
-        render(face, std::make_index_sequence<S>{}, fill);
-    }
-
-private:
-    template<size_t S, size_t... Indices>
-    void render(const Face3d<S>& f, std::index_sequence<Indices...>, bool fill){
-        window.drawPoly(fill, project(f[Indices])...);
+        projectAll(face.points.data(), S);
+        drawFace(fill, sequence<S>(), std::make_index_sequence<S>{});
+        flushTriangles();
     }
 
 public:
@@ -102,18 +357,74 @@ public:
     }
 
 public:
+    void setCulling(Culling mode){
+        culling = mode;
+    }
+
+    const CullStats& cullStats() const {
+        return stats;
+    }
+
+    void resetCullStats(){
+        stats = CullStats();
+    }
+
+public:
+    /*
+        remembers how the filled faces of renderRegObj were split into triangles, by MeshKey and face indices,
+        the split of a flat face stays valid under any view that keeps the whole face in front of the eye,
+        so concave faces are only split once
+
+        only draw calls given a MeshKey are cached, the caller bumps its generation when the vertices change,
+        faces of older generations are never looked up again and go when the cache is full,
+        at maxFaces faces the whole cache is dropped and refilled by the next draw calls
+    */
+    void setTriangulationCache(bool enabled, size_t maxFaces = DEFAULT_CACHED_FACES){
+        cacheTriangulations = enabled;
+        maxCachedFaces = std::max<size_t>(maxFaces, 1);
+        if (!enabled)
+            clearTriangulationCache();
+    }
+
+    void clearTriangulationCache(){
+        faceCache.clear();
+        cachedIndices.clear();
+    }
+
+    /* number of faces in the triangulation cache */
+    size_t cachedFaces() const {
+        return faceCache.size();
+    }
+
+public:
+    /*
+        applied to every vertex before it is projected, so composed rotations / translations
+        cost one pass per vertex and are only rounded once
+    */
+    void setTransform(const Mat4& m){
+        transform = m;
+        hasTransform = !m.isIdentity();
+    }
+
+    const Mat4& getTransform() const {
+        return transform;
+    }
+
+    /* copy of buff with m applied, positions are rounded once at the end */
     template<size_t S>
-    static std::array<Point3d, S> rotateXAxis(float angleInRadians, const std::array<Point3d, S>& buff) {
+    static std::array<Point3d, S> transformed(const Mat4& m, const std::array<Point3d, S>& buff) {
         std::array<Point3d, S> res{};
-        
+
         for (uint64_t i = 0; i < S; ++i) {
-            float newY = roundf((float)buff[i].y * (float)cosf(angleInRadians) - (float)buff[i].z * (float)sinf(angleInRadians));
-            float newZ = roundf((float)buff[i].y * (float)sinf(angleInRadians) + (float)buff[i].z * (float)cosf(angleInRadians));
+            float x = buff[i].x, y = buff[i].y, z = buff[i].z;
+            m.apply(x, y, z);
+
             res[i] = {
                 buff[i].r, buff[i].g, buff[i].b,
-                buff[i].x,
-                (int16_t)newY,
-                (int16_t)newZ
+                (int16_t)roundf(x),
+                (int16_t)roundf(y),
+                (int16_t)roundf(z),
+                buff[i].c
             };
         }
 
@@ -121,39 +432,18 @@ public:
     }
 
     template<size_t S>
-    static std::array<Point3d, S> rotateZAxis(float angleInRadians, const std::array<Point3d, S>& buff) {
-        std::array<Point3d, S> res{};
-        
-        for (uint64_t i = 0; i < S; ++i) {
-            float newX = roundf(buff[i].x * (float)cosf(angleInRadians) - (float)buff[i].y * (float)sinf(angleInRadians));
-            float newY = roundf((float)buff[i].x * (float)sinf(angleInRadians) + (float)buff[i].y * (float)cosf(angleInRadians));
-            res[i] = {
-                buff[i].r, buff[i].g, buff[i].b,
-                (int16_t)newX,
-                (int16_t)newY,
-                buff[i].z
-            };
-        }
+    static std::array<Point3d, S> rotateXAxis(float angleInRadians, const std::array<Point3d, S>& buff) {
+        return transformed(Mat4::rotationX(angleInRadians), buff);
+    }
 
-        return res;
+    template<size_t S>
+    static std::array<Point3d, S> rotateZAxis(float angleInRadians, const std::array<Point3d, S>& buff) {
+        return transformed(Mat4::rotationZ(angleInRadians), buff);
     }
 
     template<size_t S>
     static std::array<Point3d, S> rotateYAxis(float angleInRadians, const std::array<Point3d, S>& buff) {
-        std::array<Point3d, S> res{};
-        
-        for (uint64_t i = 0; i < S; ++i) {
-            float newX = roundf((float)buff[i].x * (float)cosf(angleInRadians) + (float)buff[i].z * (float)sinf(angleInRadians));
-            float newZ = roundf((float)-buff[i].x * (float)sinf(angleInRadians) + (float)buff[i].z * (float)cosf(angleInRadians));
-            
-            res[i] = {
-                buff[i].r, buff[i].g, buff[i].b,
-                (int16_t)newX,
-                buff[i].y,
-                (int16_t)newZ
-            };
-        }
-        return res;
+        return transformed(Mat4::rotationY(angleInRadians), buff);
     }
 
 /*
@@ -161,70 +451,534 @@ public:
 */
 public:
     void renderPoint(Point3d* buff, uint64_t i){
-        window.drawPoint(project(buff[i]));
+        projectAll(buff + i, 1);
+        drawPoint(0);
     }
 
     void renderEdge(Point3d* buff, uint64_t a, uint64_t b){
-        window.drawLine(
-            project(buff[a]),
-            project(buff[b])
-        );
+        const Point3d points[2] = { buff[a], buff[b] };
+
+        projectAll(points, 2);
+        drawSegment(0, 1);
     }
 
     template<typename... Args>
     void renderFace(Point3d* buff, bool fill, Args... indices) {
-        window.drawPoly(
-            fill,
-            (
-                project(buff[(uint64_t)indices])
-            )...
-        );
+        const std::array<Point3d, sizeof...(indices)> points = { buff[(uint64_t)indices]... };
+
+        projectAll(points.data(), points.size());
+        drawFace(fill, sequence<sizeof...(indices)>(), std::make_index_sequence<sizeof...(indices)>{});
+        flushTriangles();
     }
 
     template<typename... Args>
     void renderTriObj(Point3d* buff, bool fill, Args... args){
         static_assert(sizeof...(args) % 3 == 0, "Number of Indices Must be a Multiple of 3");
         
-        std::array<uint64_t, sizeof...(args)> indices = {((uint64_t)args)...};
-        for (uint64_t i = 0; i < indices.size(); i += 3){
-            window.drawTri(
-                project(buff[indices[i]]),
-                project(buff[indices[i + 1]]),
-                project(buff[indices[i + 2]]),
-                fill
-            );
-        }
+        std::array<uint32_t, sizeof...(args)> indices = {((uint32_t)args)...};
+        const uint32_t count = vertexCount(indices);
+
+        if (!inView(Sphere::around(buff, count)))
+            return;
+
+        projectAll(buff, count);
+
+        size_t left;
+        const uint32_t* visibleIndices = cull(indices.data(), indices.size() / 3, left);
+        window.drawTriangles(projected.data(), visibleIndices, left, fill);
     }
     
     template<uint64_t PointsPerFace, typename... Args>
     void renderRegObj(Point3d* buff, bool fill, Args... args){
         static_assert(sizeof...(args) % PointsPerFace == 0, "Number of Indicies Must be a Multiple of Number of Points Per Face");
 
-        std::array<uint64_t, sizeof...(args)> indices = {((uint64_t)args)...};
+        std::array<uint32_t, sizeof...(args)> indices = {((uint32_t)args)...};
+        const uint32_t count = vertexCount(indices);
 
+        if (!inView(Sphere::around(buff, count)))
+            return;
+
+        projectAll(buff, count);
+
+        // filled faces are split into triangles and drawn as one batch
         for (uint64_t i = 0; i < indices.size(); i += PointsPerFace){
-            call_drawPoly<indices.size(), PointsPerFace>(indices, i, fill, buff, std::make_integer_sequence<uint64_t, PointsPerFace>{});
+            call_drawPoly<indices.size(), PointsPerFace>(indices, i, fill, std::make_integer_sequence<uint64_t, PointsPerFace>{});
+        }
+
+        flushTriangles();
+    }
+
+    /* the same, with the splits of filled faces kept in the triangulation cache under mesh (see setTriangulationCache) */
+    template<uint64_t PointsPerFace, typename... Args>
+    void renderRegObj(MeshKey mesh, Point3d* buff, bool fill, Args... args){
+        cacheFaces = cacheTriangulations;
+        cacheMesh = mesh;
+        renderRegObj<PointsPerFace>(buff, fill, args...);
+        cacheFaces = false;
+    }
+
+    /*
+        draws every triangle of the mesh
+        every vertex is projected once, then the triangles are handed to the window as one batch,
+        triangles with an index outside of the vertex buffer are skipped
+    */
+    void draw(const Mesh& mesh, bool fill){
+        size_t count = mesh.triangleCount();
+        const uint32_t vertices = (uint32_t)mesh.vertices.size();
+
+        if (!inView(mesh.bounds.radius >= 0.0f ? mesh.bounds : Sphere::around(mesh.vertices.data(), vertices)))
+            return;
+
+        projectAll(mesh.vertices.data(), vertices);
+
+        const uint32_t* indices = mesh.indices.data();
+        const bool valid = std::all_of(mesh.indices.begin(), mesh.indices.begin() + 3 * count, [=](uint32_t i){ return i < vertices; });
+
+        if (!valid){
+            triangles.clear();
+            for (size_t i = 0; i < count; ++i){
+                const uint32_t* tri = mesh.indices.data() + 3 * i;
+
+                if (tri[0] < vertices && tri[1] < vertices && tri[2] < vertices)
+                    triangles.insert(triangles.end(), tri, tri + 3);
+            }
+
+            indices = triangles.data();
+            count = triangles.size() / 3;
         }
+
+        size_t left;
+        const uint32_t* visibleIndices = cull(indices, count, left);
+        window.drawTriangles(projected.data(), visibleIndices, left, fill);
+    }
+
+    /* rasterize on more than one thread, see Window::drawTriangles */
+    void setThreads(unsigned threads){
+        window.setThreads(threads);
     }
 
 private:
     template<size_t S, uint64_t PointsPerFace, uint64_t... Indices>
-    void call_drawPoly(const std::array<uint64_t, S>& indices, uint64_t start, bool fill, Point3d* buff, std::integer_sequence<uint64_t, Indices...>) {
-        window.drawPoly(fill, project(buff[indices[start + Indices]])...);
+    void call_drawPoly(const std::array<uint32_t, S>& indices, uint64_t start, bool fill, std::integer_sequence<uint64_t, Indices...>) {
+        drawFace(fill, std::array<uint32_t, PointsPerFace>{ indices[start + Indices]... }, std::make_index_sequence<PointsPerFace>{});
     }
 
-private:
-    Point2d project(const Point3d& p){
-        uint16_t x = roundf(((float)p.x * 50.0f) / ((float)p.z + 50.0f) + (float)(window.width() / 2));
-        uint16_t y = (float)(window.height() / 2) - roundf(((float)p.y * 50.0f) / ((float)p.z + 50.0f));
+    template<size_t S>
+    static std::array<uint32_t, S> sequence(){
+        std::array<uint32_t, S> res;
+        for (uint32_t i = 0; i < S; ++i)
+            res[i] = i;
+        return res;
+    }
+
+private: /* drawing the current draw call */
+    void drawPoint(uint32_t v){
+        if (classify(&v, 1) == 0)
+            window.drawPoint(projected[v]);
+    }
+
+    void drawSegment(uint32_t a, uint32_t b){
+        const uint32_t segment[2] = { a, b };
+
+        if (classify(segment, 2) != REJECTED)
+            drawClippedLine(a, b);
+    }
+
+    /*
+        filled faces are only split into triangles here and are drawn by flushTriangles,
+        outlines are drawn straight away
+    */
+    template<size_t S, size_t... Indices>
+    void drawFace(bool fill, const std::array<uint32_t, S>& face, std::index_sequence<Indices...>){
+        if (fill){
+            if (!anyOutside || !(outcodes[face[Indices]] | ...)){
+                if (S > 3 && cacheFaces)
+                    triangulateCached(face);
+                else
+                    window.triangulatePoly(projected.data(), face, triangles);
+                return;
+            }
+
+            // vertices outside the clip planes have no usable screen position to split by,
+            // so the face is fanned and cull clips the triangles
+            for (size_t i = 1; i + 1 < S; ++i)
+                triangles.insert(triangles.end(), { face[0], face[i], face[i + 1] });
+            return;
+        }
+
+        const uint8_t planes = classify(face.data(), S);
+
+        if (planes == REJECTED)
+            return;
+
+        if (planes){
+            for (size_t i = 0; i < S; ++i)
+                drawClippedLine(face[i], face[(i + 1) % S]);
+            return;
+        }
+
+        if (facesAway(face.data(), S)){
+            ++stats.backfaces;
+            return;
+        }
+
+        window.drawPoly(false, projected[face[Indices]]...);
+    }
+
+    /* triangulatePoly through the cache, faces that collide with a different face in it are split every time */
+    template<size_t S>
+    void triangulateCached(const std::array<uint32_t, S>& face){
+        // FNV-1a over the mesh key and the indices
+        uint64_t key = 0xCBF29CE484222325ull;
+        for (uint32_t i : { cacheMesh.id, cacheMesh.generation })
+            key = (key ^ i) * 0x100000001B3ull;
+        for (uint32_t i : face)
+            key = (key ^ i) * 0x100000001B3ull;
+
+        const auto found = faceCache.find(key);
+        if (found != faceCache.end()){
+            const CachedFace& cached = found->second;
+            const uint32_t* indices = cachedIndices.data() + cached.first;
+
+            const bool sameMesh = cached.mesh.id == cacheMesh.id && cached.mesh.generation == cacheMesh.generation;
+            if (sameMesh && cached.size == S && std::equal(face.begin(), face.end(), indices)){
+                triangles.insert(triangles.end(), indices + S, indices + S + 3 * (S - 2));
+                return;
+            }
+        }
+
+        const size_t start = triangles.size();
+        window.triangulatePoly(projected.data(), face, triangles);
+
+        if (found == faceCache.end()){
+            if (faceCache.size() >= maxCachedFaces)
+                clearTriangulationCache();
+
+            faceCache.emplace(key, CachedFace{ cacheMesh, (uint32_t)cachedIndices.size(), (uint32_t)S });
+            cachedIndices.insert(cachedIndices.end(), face.begin(), face.end());
+            cachedIndices.insert(cachedIndices.end(), triangles.begin() + start, triangles.end());
+        }
+    }
+
+    /* culls and draws the triangles drawFace collected */
+    void flushTriangles(){
+        if (triangles.empty())
+            return;
+
+        size_t left;
+        const uint32_t* visibleIndices = cull(triangles.data(), triangles.size() / 3, left);
+        window.drawTriangles(projected.data(), visibleIndices, left, true);
+
+        triangles.clear();
+    }
+
+    /* line between two vertices, cut where it leaves the clip planes (Liang-Barsky) */
+    void drawClippedLine(uint32_t a, uint32_t b){
+        const uint8_t planes = outcodes[a] | outcodes[b];
+
+        if (outcodes[a] & outcodes[b])
+            return;
+
+        if (!planes){
+            window.drawLine(projected[a], projected[b]);
+            return;
+        }
+
+        const ClipVertex from = clipVertex(a), to = clipVertex(b);
+        float t0 = 0.0f, t1 = 1.0f;
+
+        for (int plane = 0; plane < CLIP_PLANES; ++plane){
+            if (!(planes & (1 << plane))) continue;
+
+            const float da = planeDistance(plane, from), db = planeDistance(plane, to);
+
+            if (da < 0.0f && db < 0.0f)
+                return;
+            if (da < 0.0f)
+                t0 = std::max(t0, da / (da - db));
+            else if (db < 0.0f)
+                t1 = std::min(t1, da / (da - db));
+        }
+
+        if (t0 > t1)
+            return;
+
+        window.drawLine(
+            outcodes[a] ? projectClipped(lerp(from, to, t0), source[a].c) : projected[a],
+            outcodes[b] ? projectClipped(lerp(from, to, t1), source[b].c) : projected[b]
+        );
+    }
+
+private: /* culling stage */
+    /*
+        bounding sphere test against the near plane and the 4 planes through the eye and the screen edges,
+        a point is on screen when |x * 50| <= halfWidth * (z + 50), and the same for y
+    */
+    bool inView(Sphere s){
+        PROFILE_SCOPE(Culling);
+
+        ++stats.objects;
+
+        if (s.radius < 0.0f)
+            return true;
+
+        if (hasTransform){
+            transform.apply(s.x, s.y, s.z);
+            s.radius *= transform.maxScale();
+        }
+
+        const float w = s.z + 50.0f;
+        const float halfW = window.width() / 2.0f, halfH = window.height() / 2.0f;
+
+        const bool outside =
+            s.z < NEAR_Z - s.radius ||
+            50.0f * fabsf(s.x) - halfW * w > s.radius * sqrtf(2500.0f + halfW * halfW) ||
+            50.0f * fabsf(s.y) - halfH * w > s.radius * sqrtf(2500.0f + halfH * halfH);
+
+        if (outside)
+            ++stats.objectsCulled;
+
+        return !outside;
+    }
+
+    /*
+        clipping and backface culling of count triangles of the current draw call,
+        returns the triangles that are left, which is indices itself when there is nothing to cull,
+        vertices made by clipping are appended to projected
+    */
+    const uint32_t* cull(const uint32_t* indices, size_t count, size_t& left){
+        PROFILE_SCOPE(Culling);
+
+        if (culling == Culling::None && !anyOutside){
+            stats.primitives += count;
+            left = count;
+            return indices;
+        }
+
+        visible.clear();
+
+        for (size_t i = 0; i < 3 * count; i += 3){
+            const uint32_t* tri = indices + i;
+            const uint8_t planes = classify(tri, 3);
+
+            if (!planes)
+                emit(tri[0], tri[1], tri[2]);
+            else if (planes != REJECTED)
+                clipTriangle(tri, planes);
+        }
+
+        left = visible.size() / 3;
+        return visible.data();
+    }
+
+    /*
+        counts the primitive made of vertices v[0] to v[n - 1], returns the clip planes it crosses,
+        or REJECTED when it is entirely outside one of them
+    */
+    uint8_t classify(const uint32_t* v, size_t n){
+        ++stats.primitives;
+
+        uint8_t any = 0, all = 0xFF;
+        for (size_t i = 0; i < n; ++i){
+            any |= outcodes[v[i]];
+            all &= outcodes[v[i]];
+        }
+
+        if (all){
+            if (all & 1) // plane 0 is the near plane
+                ++stats.behind;
+            else
+                ++stats.offscreen;
+            return REJECTED;
+        }
+
+        if (any)
+            ++stats.clipped;
+
+        return any;
+    }
+
+    /* Sutherland-Hodgman against the clip planes the triangle crosses, what is left is emitted as a fan */
+    void clipTriangle(const uint32_t* tri, uint8_t planes){
+        // every plane adds at most one vertex
+        ClipVertex polygon[3 + CLIP_PLANES], next[3 + CLIP_PLANES];
+        size_t n = 3;
+
+        for (size_t k = 0; k < 3; ++k)
+            polygon[k] = clipVertex(tri[k]);
+
+        for (int plane = 0; plane < CLIP_PLANES && n; ++plane){
+            if (!(planes & (1 << plane))) continue;
+
+            size_t m = 0;
+            for (size_t i = 0; i < n; ++i){
+                const ClipVertex& a = polygon[i];
+                const ClipVertex& b = polygon[(i + 1) % n];
+                const float da = planeDistance(plane, a), db = planeDistance(plane, b);
+
+                if (da >= 0.0f)
+                    next[m++] = a;
+                if ((da >= 0.0f) != (db >= 0.0f))
+                    next[m++] = lerp(a, b, da / (da - db));
+            }
+
+            std::copy(next, next + m, polygon);
+            n = m;
+        }
+
+        if (n < 3)
+            return;
+
+        uint32_t out[3 + CLIP_PLANES];
+        for (size_t i = 0; i < n; ++i){
+            if (polygon[i].index != CLIPPED_VERTEX)
+                out[i] = polygon[i].index;
+            else {
+                projected.push_back(projectClipped(polygon[i], source[tri[0]].c));
+                out[i] = (uint32_t)(projected.size() - 1);
+            }
+        }
+
+        for (size_t i = 1; i + 1 < n; ++i)
+            emit(out[0], out[i], out[i + 1]);
+    }
+
+    void emit(uint32_t a, uint32_t b, uint32_t c){
+        const uint32_t tri[3] = { a, b, c };
+
+        if (facesAway(tri, 3)){
+            ++stats.backfaces;
+            return;
+        }
+
+        visible.insert(visible.end(), tri, tri + 3);
+    }
+
+    /* winding of the projected polygon, y grows downwards so counter-clockwise on screen is a negative area */
+    bool facesAway(const uint32_t* v, size_t n) const {
+        if (culling == Culling::None)
+            return false;
+
+        int64_t area = 0;
+        for (size_t i = 0; i < n; ++i){
+            const Point2d& a = projected[v[i]];
+            const Point2d& b = projected[v[(i + 1) % n]];
+            area += (int64_t)a.x * b.y - (int64_t)b.x * a.y;
+        }
+
+        return culling == Culling::Back ? area > 0 : area < 0;
+    }
+
+private: /* clip planes */
+    /*
+        distance to a clip plane in view space, scaled by some positive factor, negative on the outside
+        the side planes go through the eye, a point is inside when |50 * x| <= GUARD_BAND * (z + 50)
+    */
+    static float planeDistance(int plane, float x, float y, float z){
+        const float w = (z + 50.0f) * GUARD_BAND;
+
+        switch (plane){
+            case 0:  return z - NEAR_Z;
+            case 1:  return w + 50.0f * x;
+            case 2:  return w - 50.0f * x;
+            case 3:  return w - 50.0f * y;
+            default: return w + 50.0f * y;
+        }
+    }
+
+    static float planeDistance(int plane, const ClipVertex& v){
+        return planeDistance(plane, v.x, v.y, v.z);
+    }
+
+    static uint8_t outcode(float x, float y, float z){
+        uint8_t code = 0;
+        for (int plane = 0; plane < CLIP_PLANES; ++plane)
+            if (planeDistance(plane, x, y, z) < 0.0f)
+                code |= 1 << plane;
+        return code;
+    }
+
+    ClipVertex clipVertex(uint32_t v) const {
+        return { xs[v], ys[v], zs[v], (float)source[v].r, (float)source[v].g, (float)source[v].b, v };
+    }
+
+    static ClipVertex lerp(const ClipVertex& a, const ClipVertex& b, float t){
+        return {
+            a.x + t * (b.x - a.x),
+            a.y + t * (b.y - a.y),
+            a.z + t * (b.z - a.z),
+            a.r + t * (b.r - a.r),
+            a.g + t * (b.g - a.g),
+            a.b + t * (b.b - a.b),
+            CLIPPED_VERTEX
+        };
+    }
+
+    Point2d projectClipped(const ClipVertex& v, char c) const {
+        const Point3d attributes((uint8_t)roundf(v.r), (uint8_t)roundf(v.g), (uint8_t)roundf(v.b), 0, 0, 0, c);
+        return project(v.x, v.y, v.z, attributes);
+    }
+
+private: /* projection stage */
+    /*
+        projects buff[0] to buff[count - 1] into projected, so vertices shared by several faces are projected once,
+        the transformed positions stay in xs, ys and zs for clipping
+    */
+    void projectAll(const Point3d* buff, size_t count){
+        PROFILE_SCOPE(Projection);
+
+        projected.resize(count);
+        outcodes.resize(count);
+        xs.resize(count);
+        ys.resize(count);
+        zs.resize(count);
+
+        for (size_t i = 0; i < count; ++i){
+            xs[i] = buff[i].x;
+            ys[i] = buff[i].y;
+            zs[i] = buff[i].z;
+        }
+
+        if (hasTransform){
+            PROFILE_SCOPE(Transform);
+            transform.apply(xs.data(), ys.data(), zs.data(), count);
+        }
+
+        source = buff;
+        anyOutside = false;
+
+        for (size_t i = 0; i < count; ++i){
+            outcodes[i] = outcode(xs[i], ys[i], zs[i]);
+
+            if (outcodes[i]){
+                // no usable screen position, whatever uses it gets clipped
+                anyOutside = true;
+                projected[i] = Point2d();
+            }
+            else
+                projected[i] = project(xs[i], ys[i], zs[i], buff[i]);
+        }
+    }
+
+    /* number of vertices the indices reach into */
+    template<size_t S>
+    static uint32_t vertexCount(const std::array<uint32_t, S>& indices){
+        return S ? *std::max_element(indices.begin(), indices.end()) + 1 : 0;
+    }
+
+    /* projects the (already transformed) position, color and char come from p */
+    Point2d project(float px, float py, float pz, const Point3d& p) const {
+        int32_t x = roundf((px * 50.0f) / (pz + 50.0f) + (float)(window.width() / 2));
+        int32_t y = (float)(window.height() / 2) - roundf((py * 50.0f) / (pz + 50.0f));
 
         return {
             p.r, p.g, p.b, 
             x,
             y,
-            p.c
+            p.c,
+            1.0f / (pz + 50.0f) // reciprocal depth interpolates linearly in screen space
         };
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -3,14 +3,20 @@
 #include <cstdlib>
 #include <string>
 #include <thread>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <type_traits>
 
 #include "ANSII.cpp"
+#include "Profiler.cpp"
+#include "Palette.cpp"
 
 #ifndef Screen_cpp
 #define Screen_cpp
 
 /*
-    comment out to use characters instead of square pixels
+    comment out to use characters instead of square pixels by default, see Screen::setCellMode
     note that you might have to decrease window dimensions to account for bigger pixels
 */
 #define USE_SQUARE_PIXELS
@@ -24,20 +30,168 @@
 #   define io_write write
 #endif
 
+/* lookup tables used to format color codes without snprintf */
+namespace Digits {
+    /* "0" to "255" without leading zeros, padded to 4 chars so they can be copied as one word */
+    struct ByteTable {
+        char d[256][4];
+        uint8_t size[256];
+
+        constexpr ByteTable(): d(), size() {
+            for (int i = 0; i < 256; ++i){
+                int n = 0;
+                if (i >= 100) d[i][n++] = '0' + i / 100;
+                if (i >= 10)  d[i][n++] = '0' + i / 10 % 10;
+                d[i][n++] = '0' + i % 10;
+                size[i] = (uint8_t)n;
+            }
+        }
+    };
+
+    /* "00" to "99", 2 chars per entry */
+    struct PairTable {
+        char d[100][2];
+
+        constexpr PairTable(): d() {
+            for (int i = 0; i < 100; ++i){
+                d[i][0] = '0' + i / 10;
+                d[i][1] = '0' + i % 10;
+            }
+        }
+    };
+
+    static constexpr ByteTable BYTE{};
+    static constexpr PairTable PAIR{};
+
+    /* same as writeUInt for a byte, writes up to 4 chars but advances only past the digits */
+    inline char* writeByte(char* p, uint8_t v){
+        memcpy(p, BYTE.d[v], 4);
+        return p + BYTE.size[v];
+    }
+
+    /* writes v without leading zeros (same as %u) */
+    inline char* writeUInt(char* p, uint32_t v){
+        char tmp[10];
+        char* end = tmp + sizeof(tmp);
+        char* t = end;
+
+        while (v >= 100){
+            t -= 2;
+            memcpy(t, PAIR.d[v % 100], 2);
+            v /= 100;
+        }
+        if (v >= 10){
+            t -= 2;
+            memcpy(t, PAIR.d[v], 2);
+        }
+        else
+            *--t = '0' + v;
+
+        memcpy(p, t, end - t);
+        return p + (end - t);
+    }
+}
+
+/* how pixels are packed into terminal cells, see Screen::setCellMode */
+enum class CellMode : uint8_t {
+    Square,    // 1 pixel per 2 cells, two spaces on a background color
+    Char,      // 1 pixel per cell, its glyph in the foreground color
+    HalfBlock, // 1x2 pixels per cell, upper half block with foreground and background colors
+    Quadrant,  // 2x2 pixels per cell, two colors per cell
+    Sextant    // 2x3 pixels per cell, two colors per cell, needs a font with Unicode 13 sextants
+};
+
+#ifdef USE_SQUARE_PIXELS
+    constexpr CellMode DEFAULT_CELL_MODE = CellMode::Square;
+#else
+    constexpr CellMode DEFAULT_CELL_MODE = CellMode::Char;
+#endif
+
+/* utf-8 block glyphs, indexed by a mask of the pixels drawn in the foreground color */
+namespace Blocks {
+    struct Glyph {
+        char bytes[4];
+        uint8_t size;
+    };
+
+    constexpr Glyph utf8(uint32_t codepoint){
+        if (codepoint < 0x80)
+            return { { (char)codepoint }, 1 };
+        if (codepoint < 0x10000)
+            return { { (char)(0xE0 | codepoint >> 12), (char)(0x80 | (codepoint >> 6 & 0x3F)), (char)(0x80 | (codepoint & 0x3F)) }, 3 };
+        return { {
+            (char)(0xF0 | codepoint >> 18), (char)(0x80 | (codepoint >> 12 & 0x3F)),
+            (char)(0x80 | (codepoint >> 6 & 0x3F)), (char)(0x80 | (codepoint & 0x3F))
+        }, 4 };
+    }
+
+    /* bit 0 top left, bit 1 top right, bit 2 bottom left, bit 3 bottom right */
+    struct QuadrantTable {
+        Glyph g[16];
+
+        constexpr QuadrantTable(): g() {
+            constexpr uint32_t CODEPOINTS[16] = {
+                0x20,   0x2598, 0x259D, 0x2580, 0x2596, 0x258C, 0x259E, 0x259B,
+                0x2597, 0x259A, 0x2590, 0x259C, 0x2584, 0x2599, 0x259F, 0x2588
+            };
+            for (int i = 0; i < 16; ++i)
+                g[i] = utf8(CODEPOINTS[i]);
+        }
+    };
+
+    /*
+        bits 0 and 1 top row, 2 and 3 middle row, 4 and 5 bottom row (left, right)
+        U+1FB00 onwards skips the masks that already have a glyph: empty, left half, right half and full
+    */
+    struct SextantTable {
+        Glyph g[64];
+
+        constexpr SextantTable(): g() {
+            for (uint32_t mask = 0; mask < 64; ++mask){
+                if (mask == 0)       g[mask] = utf8(0x20);
+                else if (mask == 21) g[mask] = utf8(0x258C);
+                else if (mask == 42) g[mask] = utf8(0x2590);
+                else if (mask == 63) g[mask] = utf8(0x2588);
+                else g[mask] = utf8(0x1FB00 + mask - 1 - (mask > 21) - (mask > 42));
+            }
+        }
+    };
+
+    static constexpr QuadrantTable QUADRANTS{};
+    static constexpr SextantTable SEXTANTS{};
+    static constexpr Glyph UPPER_HALF = utf8(0x2580);
+    static constexpr Glyph LOWER_HALF = utf8(0x2584);
+}
+
 /* used in the Window class */
 struct Point2d {
 public:
     uint8_t r, g, b;
     char c;
-    uint16_t x, y;
+    int16_t x, y; // signed, points may lie off screen, the Window clips what it draws
+    float z = 0.0f; // reciprocal depth (1 / distance), larger is closer, 0 is infinitely far away
 public:
     Point2d() = default;
     Point2d(const Point2d& other) = default;
     Point2d(uint8_t r, uint8_t g, uint8_t b): r(r), g(g), b(b), c('@'), x(0), y(0) {}
-    Point2d(uint8_t r, uint8_t g, uint8_t b, uint16_t x, uint16_t y): r(r), g(g), b(b), c('@'), x(x), y(y) {}
-    Point2d(uint8_t r, uint8_t g, uint8_t b, uint16_t x, uint16_t y, char c): r(r), g(g), b(b), c(c), x(x), y(y){}
+    // coordinates are taken as int32_t so unsigned and int arguments are not narrowing conversions in braces
+    Point2d(uint8_t r, uint8_t g, uint8_t b, int32_t x, int32_t y): r(r), g(g), b(b), c('@'), x(x), y(y) {}
+    Point2d(uint8_t r, uint8_t g, uint8_t b, int32_t x, int32_t y, char c): r(r), g(g), b(b), c(c), x(x), y(y){}
+    Point2d(uint8_t r, uint8_t g, uint8_t b, int32_t x, int32_t y, char c, float z): r(r), g(g), b(b), c(c), x(x), y(y), z(z) {}
+};
+
+/* inclusive pixel rectangle */
+struct Rect {
+    uint16_t x0, y0, x1, y1;
+
+    bool empty() const { return x0 > x1 || y0 > y1; }
+    bool contains(int32_t x, int32_t y) const { return x >= x0 && x <= x1 && y >= y0 && y <= y1; }
 };
 
+/*
+    one cell of the frame, 4 bytes with the glyph so a pixel is loaded, compared and stored as one word,
+    trivially copyable so whole frames are copied with memcpy
+*/
 struct Pixel {
 public:
     uint8_t r;
@@ -47,103 +201,806 @@ public:
 public:
     Pixel(char c, uint8_t r, uint8_t g, uint8_t b): r(r), g(g), b(b), c(c) {}
     Pixel(uint8_t r, uint8_t g, uint8_t b): r(r), g(g), b(b), c('@') {}
-    Pixel(const Pixel& other): r(other.r), g(other.g), b(other.g), c(other.c) {}
+    Pixel(const Pixel& other) = default;
     Pixel(): r(0), g(0), b(0), c('@') {}
     Pixel(char c): r(0), g(0), b(0), c(c) {}
     Pixel(const Point2d& other): r(other.r), g(other.g), b(other.b), c(other.c) {}
 
     ~Pixel() = default;
+
+    Pixel& operator= (const Pixel& other) = default;
+
+    /* r, g, b and c in memory order */
+    uint32_t word() const {
+        uint32_t w;
+        memcpy(&w, this, sizeof(w));
+        return w;
+    }
+
+    bool operator== (const Pixel& other) const { return word() == other.word(); }
+    bool operator!= (const Pixel& other) const { return word() != other.word(); }
+
+    /* only the color, the glyph is ignored */
+    bool sameColor(const Pixel& other) const {
+        return ((word() ^ other.word()) & COLOR_MASK) == 0;
+    }
+private:
+    // the bytes of r, g and b in word()
+    #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        static constexpr uint32_t COLOR_MASK = 0xFFFFFF00u;
+    #else
+        static constexpr uint32_t COLOR_MASK = 0x00FFFFFFu;
+    #endif
 };
 
+static_assert(sizeof(Pixel) == 4 && std::is_trivially_copyable<Pixel>::value, "Pixel has to stay a packed word");
+
 class Screen {
 private:
     uint16_t W;
     uint16_t H;
-    std::vector<std::vector<Pixel>> pixels; // since screen size can be dynamic
+    std::vector<Pixel> pixels; // row-major, pixel (x, y) is at y * W + x
+
+    /*
+        optional depth buffer, same layout as pixels
+        holds the reciprocal depth of the closest thing drawn so far (see Point2d::z)
+    */
+    std::vector<float> depth;
+
+    /*
+        the last frame that was written to the terminal
+        when incremental presenting is enabled only the cells that differ from it are re-sent
+    */
+    std::vector<Pixel> front;
+    bool incremental = false;
+    bool frontValid = false;
+
+    /* what clear() fills the frame with */
+    Pixel background;
+
+    /*
+        optional dirty rect tracking, the Window reports the screen area every draw call may have touched,
+        drawn is what clear() has to reset, changed is what present() has to compare with the front buffer
+    */
+    bool tracking = false;
+    Rect drawn = NO_RECT;
+    Rect changed = NO_RECT;
+
+    static constexpr Rect NO_RECT = { UINT16_MAX, UINT16_MAX, 0, 0 };
+
+    /* escape sequences for a whole frame are built here, sized for the worst case on resize */
+    std::vector<char> out;
+
+    /* palette the colors are encoded for, see setColorMode */
+    Palette::Mode colors = Palette::Mode::TrueColor;
+    bool dithered = false;
+
+    CellMode cells = DEFAULT_CELL_MODE;
+
+    uint16_t terminalColumns = 0; // width of the terminal if known, see setTerminalColumns
+
+    int fd = 1; // where frames are written, negative encodes them without writing (benchmarks)
+    size_t presented = 0; // size of the last encoded frame in bytes
 public:
-    Screen(uint16_t W, uint16_t H): W(W), H(H){
-        pixels.resize(W);
-        for (auto& column : pixels){
-            column.resize(H);
-            std::fill(column.begin(), column.end(), Pixel());
-        }
+    Screen(uint16_t W, uint16_t H): W(W), H(H), pixels((size_t)W * H){
+        out.resize(outputCapacity());
     }
     ~Screen() = default;
 public:
     uint16_t width() const { return W; }
     uint16_t height()const { return H; }
-    std::vector<std::vector<Pixel>>& data() { return pixels; }
+    std::vector<Pixel>& data() { return pixels; }
+    const std::vector<Pixel>& data() const { return pixels; }
+
+    /* distance in pixels between vertically adjacent pixels */
+    size_t stride() const { return W; }
+
+    Pixel* row(uint16_t y) { return pixels.data() + (size_t)y * W; }
+    const Pixel* row(uint16_t y) const { return pixels.data() + (size_t)y * W; }
+
+    Pixel& at(uint16_t x, uint16_t y) { return pixels[(size_t)y * W + x]; }
+    const Pixel& at(uint16_t x, uint16_t y) const { return pixels[(size_t)y * W + x]; }
+
+    bool hasDepth() const { return !depth.empty(); }
+
+    /* nullptr if the depth buffer is disabled */
+    float* depthRow(uint16_t y) { return depth.empty() ? nullptr : depth.data() + (size_t)y * W; }
 public:
+    /* with dirty tracking only the area drawn to since the last clear is reset, the rest still is background */
     void clear(){
-        for (auto& row : pixels){
+        if (!tracking){
             // avoid allocating new memory
-            std::fill(row.begin(), row.end(), Pixel());
+            fill(pixels.data(), pixels.size(), background);
+            std::fill(depth.begin(), depth.end(), 0.0f);
+            return;
+        }
+
+        if (drawn.empty())
+            return;
+
+        const size_t n = drawn.x1 - drawn.x0 + 1;
+        for (uint16_t y = drawn.y0; y <= drawn.y1; ++y){
+            fill(row(y) + drawn.x0, n, background);
+            if (float* d = depthRow(y))
+                std::fill(d + drawn.x0, d + drawn.x0 + n, 0.0f);
+        }
+
+        unite(changed, drawn);
+        drawn = NO_RECT;
+    }
+
+    /*
+        sets n pixels to value, the filled part is copied onto the rest in doubling blocks,
+        so this runs at memcpy speed where a plain loop of 4 byte stores does not get vectorized
+    */
+    static void fill(Pixel* dst, size_t n, const Pixel& value){
+        if (n == 0)
+            return;
+
+        dst[0] = value;
+        for (size_t filled = 1; filled < n;){
+            const size_t count = std::min(filled, n - filled);
+            memcpy(dst + filled, dst, count * sizeof(Pixel));
+            filled += count;
+        }
+    }
+
+public: /* clear pixel and dirty rects */
+    /* takes effect with the next clear() */
+    void setClearPixel(const Pixel& p){
+        background = p;
+        drawn = bounds(); // nothing is background anymore
+    }
+
+    const Pixel& clearPixel() const {
+        return background;
+    }
+
+    /*
+        with dirty tracking clear() and an incremental present() only look at what was reported
+        through markDirty since, anything written to the pixels without reporting it may be left behind
+    */
+    void setDirtyTracking(bool enable){
+        tracking = enable;
+        drawn = changed = bounds();
+    }
+
+    bool isDirtyTracking() const {
+        return tracking;
+    }
+
+    /* x0..x1, y0..y1 may have been written to, inclusive and may lie off screen, ignored without dirty tracking */
+    void markDirty(int32_t x0, int32_t y0, int32_t x1, int32_t y1){
+        if (!tracking || x1 < 0 || y1 < 0 || x0 >= W || y0 >= H || x0 > x1 || y0 > y1)
+            return;
+
+        const Rect r = {
+            (uint16_t)std::max<int32_t>(x0, 0), (uint16_t)std::max<int32_t>(y0, 0),
+            (uint16_t)std::min<int32_t>(x1, W - 1), (uint16_t)std::min<int32_t>(y1, H - 1)
+        };
+
+        unite(drawn, r);
+        unite(changed, r);
+    }
+
+    /* whole screen, NO_RECT for an empty one */
+    Rect bounds() const {
+        return W && H ? Rect{ 0, 0, (uint16_t)(W - 1), (uint16_t)(H - 1) } : NO_RECT;
+    }
+
+private:
+    static void unite(Rect& r, const Rect& other){
+        r = {
+            std::min(r.x0, other.x0), std::min(r.y0, other.y0),
+            std::max(r.x1, other.x1), std::max(r.y1, other.y1)
+        };
+    }
+
+public:
+    void enableDepth(bool enable){
+        if (enable)
+            depth.assign((size_t)W * H, 0.0f);
+        else {
+            depth.clear();
+            depth.shrink_to_fit();
         }
     }
 
     void reset(){
         pixels.clear();
+        depth.clear();
+        front.clear();
+        frontValid = false;
+        out.clear();
+        out.shrink_to_fit();
     }
 
     void resize(uint16_t W, uint16_t H){
+        // keep the part of the old frame that still fits
+        std::vector<Pixel> resized((size_t)W * H, background);
+
+        const uint16_t keepW = std::min(W, this->W);
+        const uint16_t keepH = std::min(H, this->H);
+
+        for (uint16_t y = 0; y < keepH; ++y)
+            std::copy(row(y), row(y) + keepW, resized.begin() + (size_t)y * W);
+
+        pixels.swap(resized);
+
+        if (hasDepth())
+            depth.assign((size_t)W * H, 0.0f);
+
         this->W = W;
         this->H = H;
 
-        pixels.resize(W);
-        for (auto& column : pixels)
-            column.resize(H);
+        frontValid = false; // terminal contents no longer line up with the front buffer
+        drawn = changed = bounds();
+
+        if (out.size() < outputCapacity())
+            out.resize(outputCapacity());
+    }
+
+    /* only send changed cells on present, see present() */
+    void setIncremental(bool enable){
+        incremental = enable;
+        frontValid = false;
+
+        if (!enable)
+            front.clear();
+    }
+
+    bool isIncremental() const {
+        return incremental;
+    }
+
+    /*
+        encode colors for terminals without truecolor, quantized through a lookup table (see Palette.cpp),
+        with dither set neighbouring cells are offset by an ordered pattern to hide the banding
+    */
+    void setColorMode(Palette::Mode mode, bool dither = false){
+        colors = mode;
+        dithered = dither && mode != Palette::Mode::TrueColor;
+        frontValid = false;
+    }
+
+    Palette::Mode colorMode() const {
+        return colors;
+    }
+
+    bool isDithered() const {
+        return dithered;
+    }
+
+    /*
+        packs pixels into terminal cells, the block modes trade glyphs for resolution:
+        HalfBlock and Quadrant double the pixels per cell, Sextant triples them,
+        Quadrant and Sextant can only show two colors per cell so they blend the pixels of busy cells
+    */
+    void setCellMode(CellMode mode){
+        cells = mode;
+        frontValid = false;
+
+        if (out.size() < outputCapacity())
+            out.resize(outputCapacity());
+    }
+
+    CellMode cellMode() const {
+        return cells;
+    }
+
+    /* pixels per cell */
+    uint16_t cellWidth() const { return cellWidthOf(cells); }
+    uint16_t cellHeight() const { return cellHeightOf(cells); }
+
+    /* terminal columns per cell */
+    uint16_t cellColumns() const { return cellColumnsOf(cells); }
+
+    static constexpr uint16_t cellWidthOf(CellMode mode){
+        return mode == CellMode::Quadrant || mode == CellMode::Sextant ? 2 : 1;
+    }
+
+    static constexpr uint16_t cellHeightOf(CellMode mode){
+        return mode == CellMode::Sextant ? 3 : mode == CellMode::Char || mode == CellMode::Square ? 1 : 2;
+    }
+
+    static constexpr uint16_t cellColumnsOf(CellMode mode){
+        return mode == CellMode::Square ? 2 : 1;
+    }
+
+    /*
+        width of the terminal in columns, 0 if unknown
+        when the frame reaches the right edge of the terminal, blank row tails are erased with
+        erase in line (ESC [K), otherwise with erase characters (ESC [nX) so nothing right of the frame is touched
+    */
+    void setTerminalColumns(uint16_t columns){
+        terminalColumns = columns;
+    }
+
+    uint16_t terminalWidth() const {
+        return terminalColumns;
+    }
+
+    /* file descriptor frames are written to, a negative one makes present() only encode */
+    void setOutput(int fd){
+        this->fd = fd;
+        frontValid = false;
+    }
+
+    int output() const {
+        return fd;
+    }
+
+    /* bytes of escape codes the last present() produced, whether or not they were written */
+    size_t presentedBytes() const {
+        return presented;
+    }
+
+    /* forces the next present to redraw every cell, e.g. after something else wrote to the terminal */
+    void invalidate(){
+        frontValid = false;
     }
 
-    std::vector<Pixel>& operator[] (uint16_t i){
-        return pixels[i];
+    /* lets screen[x][y] keep working on top of the row-major buffer */
+    template<typename T>
+    class Column {
+    private:
+        T* base;
+        size_t stride;
+    public:
+        Column(T* base, size_t stride): base(base), stride(stride) {}
+
+        T& operator[] (uint16_t y) const {
+            return base[(size_t)y * stride];
+        }
+    };
+
+    Column<Pixel> operator[] (uint16_t x){
+        return Column<Pixel>(pixels.data() + x, W);
     }
 
-    const std::vector<Pixel>& operator[] (uint16_t i) const {
-        return pixels[i];
+    Column<const Pixel> operator[] (uint16_t x) const {
+        return Column<const Pixel>(pixels.data() + x, W);
     }
 public:
-    void present() const {
-        #ifdef USE_SQUARE_PIXELS
-            char* str = new char[H * (W * 22 + 1) + 7 + 7 + 4 + 4 + 4]; // null - initialized
-        #endif
-        #ifndef USE_SQUARE_PIXELS
-            char* str = new char[H * (W * 21 + 1) + 7 + 7 + 4 + 4 + 4];
-        #endif
-
-        size_t pos = 0;
-
-
-        snprintf(str + pos, 4, "\033[s"); pos += 4; // save cursor pos
-        snprintf(str + pos, 4, "\033[H"); pos += 4; // reset cursor pos (to top left)
-        snprintf(str + pos, 7, "\033[?25l");  pos += 7; // hide cursor
-
-        for (uint16_t i = 0; i < H; ++i){
-            for (uint16_t j = 0; j < W; ++j){
-                const Pixel& pixel = pixels[j][i];
-
-                
-
-                #ifdef USE_SQUARE_PIXELS
-                    snprintf(str + pos, 20, "\033[48;2;%03u;%03u;%03um", pixel.r, pixel.g, pixel.b); // write the color string
-                    pos += 20;
-                    str[pos++] = ' '; // write the char
-                    str[pos++] = ' ';
-                #endif
-                #ifndef USE_SQUARE_PIXELS
-                    snprintf(str + pos, 20, "\033[38;2;%03u;%03u;%03um", pixel.r, pixel.g, pixel.b); // write the color string
-                    pos += 20;
-                    str[pos++] = pixel.c;
-                #endif
-                
+    /*
+        writes the frame to the terminal
+
+        if incremental presenting is enabled, cells that match the previously presented frame are skipped:
+        every run of changed cells is prefixed with a cursor move
+
+        the colors the terminal is set to are tracked over the whole frame, cursor moves do not change them,
+        so a color code is only written when a cell needs a different one (after quantization when a
+        reduced color mode is set), and a row that ends in blank cells of one color is finished by erasing,
+        every frame ends by resetting the colors, so nothing is left set for the next frame or cell mode
+    */
+    void present(){
+        PROFILE_SCOPE(Encode);
+
+        const bool diff = incremental && frontValid;
+
+        // with dirty tracking the pixels outside of changed are the same as in the front buffer
+        const Rect area = diff && tracking ? changed : bounds();
+
+        char* str = out.data();
+        char* pos = str;
+
+        pos = put(pos, "\033[s"); // save cursor pos
+        pos = put(pos, "\033[?25l"); // hide cursor
+
+        // the cell mode is a template parameter so the per cell code does not branch on it
+        switch (cells){
+            case CellMode::Square:    pos = putRows<CellMode::Square>(pos, diff, area);    break;
+            case CellMode::Char:      pos = putRows<CellMode::Char>(pos, diff, area);      break;
+            case CellMode::HalfBlock: pos = putRows<CellMode::HalfBlock>(pos, diff, area); break;
+            case CellMode::Quadrant:  pos = putRows<CellMode::Quadrant>(pos, diff, area);  break;
+            case CellMode::Sextant:   pos = putRows<CellMode::Sextant>(pos, diff, area);   break;
+        }
+
+        pos = put(pos, "\033[?25h"); // show cursor
+        pos = put(pos, "\033[u"); // load cursor pos
+        pos = put(pos, "\033[0m"); // reset colors
+
+        presented = pos - str;
+        PROFILE_COUNT(Bytes, presented);
+
+        bool written = true;
+        if (fd >= 0){
+            PROFILE_SCOPE(Write);
+            written = writeAll(fd, str, presented);
+        }
+
+        if (incremental){
+            if (diff && tracking){
+                if (!area.empty())
+                    std::copy(row(area.y0), row(area.y1) + W, front.begin() + (size_t)area.y0 * W);
+            }
+            else
+                front = pixels;
+            frontValid = written; // after a failed write the terminal contents are unknown
+        }
+
+        changed = NO_RECT;
+    }
+
+    /* write(2) may accept only part of the buffer (pipes, ptys over ssh), so keep going until all of it is out */
+    static bool writeAll(int fd, const char* data, size_t size){
+        while (size > 0){
+            const long n = io_write(fd, data, size);
+
+            if (n < 0){
+                if (errno == EINTR || errno == EAGAIN){
+                    std::this_thread::yield();
+                    continue;
+                }
+                return false;
+            }
+
+            data += n;
+            size -= n;
+        }
+        return true;
+    }
+
+private:
+    /* longest run of unchanged cells that gets rewritten instead of skipped with a cursor move */
+    static constexpr uint16_t MAX_RUN_GAP = 3;
+
+    /* shortest row tail that gets erased instead of written cell by cell */
+    static constexpr uint16_t MIN_ERASE_CELLS = 4;
+
+    /* worst case size of a frame: every cell changed and every row starts with a cursor move */
+    size_t outputCapacity() const {
+        size_t cellSize;
+        switch (cells){
+            case CellMode::Square: cellSize = 21; break; // color code + 2 spaces
+            case CellMode::Char:   cellSize = 20; break; // color code + char
+            default:               cellSize = 42; break; // 2 color codes + block glyph
+        }
+
+        const size_t rows = (H + cellHeight() - 1) / cellHeight();
+        const size_t cols = (W + cellWidth() - 1) / cellWidth();
+        return rows * (cols * cellSize + 14) + 36; // + cursor save / hide / show / load and the color reset
+    }
+
+    /* colors the terminal is currently set to, as colorKey values, -1 when unknown */
+    struct Sgr {
+        int32_t fg = -1;
+        int32_t bg = -1;
+    };
+
+    /* encodes the cells that cover area, or only the changed ones among them with diff, see present() */
+    template<CellMode M>
+    char* putRows(char* pos, bool diff, const Rect& area) const {
+        constexpr uint16_t CW = cellWidthOf(M), CH = cellHeightOf(M), COLUMNS = cellColumnsOf(M);
+
+        if (area.empty())
+            return pos;
+
+        const uint16_t cols = (W + CW - 1) / CW;
+        const uint16_t last = area.x1 / CW + 1; // cells from there on are not in area
+
+        Sgr sgr; // unknown at the start of a frame, something else may have written in between
+
+        for (uint16_t i = area.y0 / CH; i <= area.y1 / CH; ++i){
+            if (diff && !rowChanged<M>(i))
+                continue;
+
+            Tail tail = { UINT16_MAX, -1, Pixel() }; // found once the row has a changed cell
+            uint16_t j = area.x0 / CW;
+
+            while (j < last){
+                if (diff && !cellChanged<M>(j, i)){
+                    ++j;
+                    continue;
+                }
+
+                if (tail.start == UINT16_MAX)
+                    tail = blankTail<M>(i, cols);
+
+                // start of a run of changed cells
+                pos = put(pos, "\033[");
+                pos = Digits::writeUInt(pos, i + 1);
+                *pos++ = ';';
+                pos = Digits::writeUInt(pos, j * COLUMNS + 1);
+                *pos++ = 'H';
+
+                while (j < cols){
+                    if (j >= tail.start && cols - j >= MIN_ERASE_CELLS){
+                        pos = eraseTail<M>(pos, tail, cols - j, cols, sgr);
+                        j = cols;
+                        break;
+                    }
+
+                    if (diff && !cellChanged<M>(j, i)){
+                        // rewriting a short gap of unchanged cells is cheaper than another cursor move
+                        uint16_t next = j;
+                        while (next < cols && next - j < MAX_RUN_GAP && !cellChanged<M>(next, i))
+                            ++next;
+
+                        if (next == cols || next - j >= MAX_RUN_GAP)
+                            break;
+                    }
+
+                    pos = putCell<M>(pos, j, i, sgr);
+                    ++j;
+                }
+            }
+        }
+
+        return pos;
+    }
+
+    /* cells from start to the end of a row are blank (see blankKey) and of the same color */
+    struct Tail {
+        uint16_t start;
+        int32_t key;
+        Pixel color;
+    };
+
+    /*
+        color key of a cell that shows nothing but its background color, -1 if it shows anything else
+        glyphs in Char mode are never blank, their background is the terminal's
+    */
+    template<CellMode M>
+    int32_t blankKey(uint16_t cx, uint16_t cy, Pixel& color) const {
+        constexpr uint16_t CW = cellWidthOf(M), CH = cellHeightOf(M);
+
+        switch (M){
+            case CellMode::Square:
+                color = pixels[(size_t)cy * W + cx];
+                return colorKey(color, cx, cy);
+            case CellMode::Char:
+                return -1;
+            case CellMode::HalfBlock: {
+                color = cellPixel(cx, 2 * cy);
+                const int32_t key = colorKey(color, cx, 2 * cy);
+                return key == colorKey(cellPixel(cx, 2 * cy + 1), cx, 2 * cy + 1) ? key : -1;
+            }
+            case CellMode::Quadrant:
+            case CellMode::Sextant: {
+                // same test as the single color case of putSplitCell
+                color = cellPixel(cx * CW, cy * CH);
+                for (uint16_t y = 0; y < CH; ++y)
+                    for (uint16_t x = 0; x < CW; ++x)
+                        if (!cellPixel(cx * CW + x, cy * CH + y).sameColor(color))
+                            return -1;
+                return colorKey(color, cx, cy);
+            }
+        }
+        return -1;
+    }
+
+    /* scans the row from the right, start is cols if the last cell is not blank */
+    template<CellMode M>
+    Tail blankTail(uint16_t cy, uint16_t cols) const {
+        Tail tail = { cols, -1, Pixel() };
+        if (M == CellMode::Char)
+            return tail;
+
+        Pixel color;
+        for (uint16_t cx = cols; cx-- > 0;){
+            const int32_t key = blankKey<M>(cx, cy, color);
+            if (key < 0 || (tail.key >= 0 && key != tail.key))
+                break;
+
+            tail = { cx, key, color };
+        }
+        return tail;
+    }
+
+    /* fills the last count cells of the row, starting at the cursor, with the background color of tail */
+    template<CellMode M>
+    char* eraseTail(char* p, const Tail& tail, uint16_t count, uint16_t cols, Sgr& sgr) const {
+        p = setBackground(p, tail.color, tail.key, sgr);
+
+        if (terminalColumns && terminalColumns == cols * cellColumnsOf(M))
+            return put(p, "\033[K");
+
+        p = put(p, "\033[");
+        p = Digits::writeUInt(p, (uint32_t)count * cellColumnsOf(M));
+        *p++ = 'X';
+        return p;
+    }
+
+    /* true if any pixel of the row of cells differs from the front buffer, rows are contiguous so this is one memcmp */
+    template<CellMode M>
+    bool rowChanged(uint16_t cy) const {
+        constexpr uint16_t CH = cellHeightOf(M);
+
+        const size_t y0 = (size_t)cy * CH, y1 = std::min<size_t>(y0 + CH, H);
+        return memcmp(pixels.data() + y0 * W, front.data() + y0 * W, (y1 - y0) * W * sizeof(Pixel)) != 0;
+    }
+
+    /* true if any pixel of the cell differs from the front buffer */
+    template<CellMode M>
+    bool cellChanged(uint16_t cx, uint16_t cy) const {
+        constexpr uint16_t CW = cellWidthOf(M), CH = cellHeightOf(M);
+
+        if (CW == 1 && CH == 1)
+            return pixels[(size_t)cy * W + cx] != front[(size_t)cy * W + cx];
+
+        const uint16_t x0 = cx * CW, y0 = cy * CH;
+        const uint16_t x1 = std::min<uint16_t>(x0 + CW, W), y1 = std::min<uint16_t>(y0 + CH, H);
+
+        for (uint16_t y = y0; y < y1; ++y)
+            for (uint16_t x = x0; x < x1; ++x)
+                if (pixels[(size_t)y * W + x] != front[(size_t)y * W + x])
+                    return true;
+        return false;
+    }
+
+    /* pixel (x, y), black outside of the screen for cells that stick out over the bottom or right edge */
+    Pixel cellPixel(uint16_t x, uint16_t y) const {
+        return x < W && y < H ? pixels[(size_t)y * W + x] : Pixel();
+    }
+
+    /* writes the cell at (cx, cy) in cell coordinates, color codes are only written if they differ from sgr */
+    template<CellMode M>
+    char* putCell(char* p, uint16_t cx, uint16_t cy, Sgr& sgr) const {
+        switch (M){
+            case CellMode::Square: {
+                const Pixel& pixel = pixels[(size_t)cy * W + cx];
+                p = setBackground(p, pixel, colorKey(pixel, cx, cy), sgr);
+                *p++ = ' ';
+                *p++ = ' ';
+                return p;
+            }
+            case CellMode::Char: {
+                const Pixel& pixel = pixels[(size_t)cy * W + cx];
+                p = setForeground(p, pixel, colorKey(pixel, cx, cy), sgr);
+                *p++ = pixel.c;
+                return p;
+            }
+            case CellMode::HalfBlock: {
+                const Pixel top = cellPixel(cx, 2 * cy), bottom = cellPixel(cx, 2 * cy + 1);
+                return putBlock(p, top, colorKey(top, cx, 2 * cy), bottom, colorKey(bottom, cx, 2 * cy + 1),
+                    Blocks::UPPER_HALF, Blocks::LOWER_HALF, sgr);
             }
-            if (i != H - 1) str[pos++] = '\n'; // avoid last newline
+            case CellMode::Quadrant:
+                return putSplitCell<2, 2>(p, cx, cy, Blocks::QUADRANTS.g, sgr);
+            case CellMode::Sextant:
+                return putSplitCell<2, 3>(p, cx, cy, Blocks::SEXTANTS.g, sgr);
         }
-        
-        snprintf(str + pos, 7, "\033[?25h");  pos += 7; // show cursor
-        snprintf(str + pos, 4, "\033[u"); pos += 4; // load cursor pos
+        return p;
+    }
+
+    /*
+        cells of CW x CH pixels are split into the two colors that are furthest apart,
+        every pixel goes to the closer one and both are averaged over their pixels
+    */
+    template<uint16_t CW, uint16_t CH>
+    char* putSplitCell(char* p, uint16_t cx, uint16_t cy, const Blocks::Glyph* glyphs, Sgr& sgr) const {
+        constexpr int N = CW * CH;
+
+        Pixel cell[N];
+        for (int k = 0; k < N; ++k)
+            cell[k] = cellPixel(cx * CW + k % CW, cy * CH + k / CW);
+
+        int a = 0, b = 0, furthest = 0;
+        for (int k = 0; k < N; ++k)
+            for (int l = k + 1; l < N; ++l){
+                const int d = distance(cell[k], cell[l]);
+                if (d > furthest){ furthest = d; a = k; b = l; }
+            }
+
+        if (furthest == 0)
+            return putBlock(p, cell[0], colorKey(cell[0], cx, cy), cell[0], colorKey(cell[0], cx, cy), glyphs[0], glyphs[0], sgr);
+
+        uint32_t mask = 0;
+        int sum[2][3] = {}, count[2] = {};
+        for (int k = 0; k < N; ++k){
+            const int group = distance(cell[k], cell[a]) <= distance(cell[k], cell[b]) ? 0 : 1;
+            if (group == 0) mask |= 1u << k;
+
+            sum[group][0] += cell[k].r; sum[group][1] += cell[k].g; sum[group][2] += cell[k].b;
+            ++count[group];
+        }
+
+        const Pixel fg((uint8_t)(sum[0][0] / count[0]), (uint8_t)(sum[0][1] / count[0]), (uint8_t)(sum[0][2] / count[0]));
+        const Pixel bg((uint8_t)(sum[1][0] / count[1]), (uint8_t)(sum[1][1] / count[1]), (uint8_t)(sum[1][2] / count[1]));
+
+        return putBlock(p, fg, colorKey(fg, cx, cy), bg, colorKey(bg, cx, cy), glyphs[mask], glyphs[~mask & (N == 4 ? 0xF : 0x3F)], sgr);
+    }
+
+    static int distance(const Pixel& a, const Pixel& b){
+        const int dr = a.r - b.r, dg = a.g - b.g, db = a.b - b.b;
+        return dr * dr + dg * dg + db * db;
+    }
+
+    /*
+        glyph drawn in fg on bg, or the inverse glyph with the colors swapped,
+        whichever needs fewer color codes, a single color is written as a space on the background
+    */
+    char* putBlock(char* p, const Pixel& fg, int32_t fgKey, const Pixel& bg, int32_t bgKey,
+                   const Blocks::Glyph& glyph, const Blocks::Glyph& inverse, Sgr& sgr) const {
+        if (fgKey == bgKey){
+            p = setBackground(p, bg, bgKey, sgr);
+            *p++ = ' ';
+            return p;
+        }
+
+        const int cost = (fgKey != sgr.fg) + (bgKey != sgr.bg);
+        const int swappedCost = (bgKey != sgr.fg) + (fgKey != sgr.bg);
+
+        const Blocks::Glyph* g = &glyph;
+        if (swappedCost < cost){
+            p = setForeground(p, bg, bgKey, sgr);
+            p = setBackground(p, fg, fgKey, sgr);
+            g = &inverse;
+        }
+        else {
+            p = setForeground(p, fg, fgKey, sgr);
+            p = setBackground(p, bg, bgKey, sgr);
+        }
+
+        memcpy(p, g->bytes, g->size);
+        return p + g->size;
+    }
+
+    char* setForeground(char* p, const Pixel& pixel, int32_t key, Sgr& sgr) const {
+        if (key == sgr.fg) return p;
+        sgr.fg = key;
+        return putCellColor(p, pixel, key, false);
+    }
+
+    char* setBackground(char* p, const Pixel& pixel, int32_t key, Sgr& sgr) const {
+        if (key == sgr.bg) return p;
+        sgr.bg = key;
+        return putCellColor(p, pixel, key, true);
+    }
+
+    template<size_t N>
+    static char* put(char* p, const char (&literal)[N]){
+        memcpy(p, literal, N - 1);
+        return p + N - 1;
+    }
+
+    /* packed rgb in truecolor mode, otherwise the palette index the cell at (x, y) ends up with */
+    int32_t colorKey(const Pixel& pixel, uint16_t x, uint16_t y) const {
+        if (colors == Palette::Mode::TrueColor)
+            return (int32_t)pixel.r << 16 | (int32_t)pixel.g << 8 | (int32_t)pixel.b;
+
+        return paletteKey(pixel, x, y);
+    }
+
+    /* kept out of colorKey so the truecolor case stays small enough to inline */
+    int32_t paletteKey(const Pixel& pixel, uint16_t x, uint16_t y) const {
+        const Palette::Table& table = Palette::table(colors);
+
+        if (!dithered)
+            return table(pixel.r, pixel.g, pixel.b);
+
+        const Palette::Dither& dither = Palette::dither(colors);
+        return table(dither.apply(pixel.r, x, y), dither.apply(pixel.g, x, y), dither.apply(pixel.b, x, y));
+    }
+
+    char* putCellColor(char* p, const Pixel& pixel, int32_t key, bool background) const {
+        switch (colors){
+            case Palette::Mode::TrueColor:
+                return background ? putColor(p, "\033[48;2;", pixel) : putColor(p, "\033[38;2;", pixel);
+            case Palette::Mode::Xterm256:
+                p = background ? put(p, "\033[48;5;") : put(p, "\033[38;5;");
+                break;
+            case Palette::Mode::Ansi16:
+                // 30-37 and 90-97 for the foreground, 10 more for the background
+                p = put(p, "\033[");
+                key = (key < 8 ? 30 + key : 90 + key - 8) + (background ? 10 : 0);
+                break;
+        }
+
+        p = Digits::writeUInt(p, (uint32_t)key);
+        *p++ = 'm';
+        return p;
+    }
 
-        write(1, str, pos);
-        delete[] str;
+    /* prefix followed by "R;G;Bm", without leading zeros */
+    template<size_t N>
+    static char* putColor(char* p, const char (&prefix)[N], const Pixel& pixel){
+        p = put(p, prefix);
+        p = Digits::writeByte(p, pixel.r); *p++ = ';';
+        p = Digits::writeByte(p, pixel.g); *p++ = ';';
+        p = Digits::writeByte(p, pixel.b); *p++ = 'm';
+        return p;
     }
 };
 
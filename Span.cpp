@@ -0,0 +1,200 @@
+#include <cstdint>
+
+#include "Screen.cpp"
+
+#ifndef Span_cpp
+#define Span_cpp
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#   include <immintrin.h>
+#   define SPAN_X86_SIMD
+#endif
+
+/*
+    kernels that fill a horizontal run of pixels with a linearly interpolated color
+
+    colors are stepped in 16.16 fixed point, and every kernel computes start + i * step with
+    wrapping 32 bit adds and clamps the integer part to 0..255, so the SIMD kernels produce
+    exactly the same pixels as the scalar one
+*/
+namespace Span {
+    static_assert(sizeof(Pixel) == 4, "span kernels write pixels as 32 bit words");
+
+    struct Gradient {
+        uint32_t r, g, b;    // 16.16 fixed point value of the first pixel
+        uint32_t dr, dg, db; // 16.16 fixed point step per pixel
+        char c;
+
+        /* a -> b over a span of n pixels (both ends included) */
+        static Gradient between(const Point2d& a, const Point2d& b, uint32_t n){
+            const int32_t steps = n > 1 ? (int32_t)n - 1 : 1;
+
+            return {
+                (uint32_t)a.r << 16, (uint32_t)a.g << 16, (uint32_t)a.b << 16,
+                (uint32_t)((((int32_t)b.r - (int32_t)a.r) * 65536) / steps),
+                (uint32_t)((((int32_t)b.g - (int32_t)a.g) * 65536) / steps),
+                (uint32_t)((((int32_t)b.b - (int32_t)a.b) * 65536) / steps),
+                a.c
+            };
+        }
+
+        /* the same gradient, starting n pixels further along */
+        Gradient advanced(uint32_t n) const {
+            return { r + n * dr, g + n * dg, b + n * db, dr, dg, db, c };
+        }
+
+        /* moves on to the next pixel */
+        void step(){
+            r += dr; g += dg; b += db;
+        }
+
+        /* from float values and per pixel steps */
+        static Gradient fromFloat(float r, float g, float b, float dr, float dg, float db, char c){
+            return {
+                (uint32_t)(int32_t)(r * 65536.0f), (uint32_t)(int32_t)(g * 65536.0f), (uint32_t)(int32_t)(b * 65536.0f),
+                (uint32_t)(int32_t)(dr * 65536.0f), (uint32_t)(int32_t)(dg * 65536.0f), (uint32_t)(int32_t)(db * 65536.0f),
+                c
+            };
+        }
+    };
+
+    /* integer part of a 16.16 value, clamped to a color channel */
+    inline uint8_t channel(uint32_t v){
+        const int32_t i = (int32_t)v >> 16;
+        return i < 0 ? 0 : i > 255 ? 255 : (uint8_t)i;
+    }
+
+    inline void fillScalar(Pixel* dst, uint32_t n, const Gradient& grad){
+        uint32_t r = grad.r, g = grad.g, b = grad.b;
+
+        for (uint32_t i = 0; i < n; ++i){
+            dst[i] = Pixel(grad.c, channel(r), channel(g), channel(b));
+            r += grad.dr; g += grad.dg; b += grad.db;
+        }
+    }
+
+    /* only writes pixels whose depth passes, see Window::setDepthTest */
+    inline void fillDepthTested(Pixel* dst, float* depth, uint32_t n, const Gradient& grad, float z, float dz){
+        uint32_t r = grad.r, g = grad.g, b = grad.b;
+
+        for (uint32_t i = 0; i < n; ++i){
+            if (z >= depth[i]){
+                depth[i] = z;
+                dst[i] = Pixel(grad.c, channel(r), channel(g), channel(b));
+            }
+            r += grad.dr; g += grad.dg; b += grad.db; z += dz;
+        }
+    }
+
+#ifdef SPAN_X86_SIMD
+    /* 8 pixels per iteration */
+    __attribute__((target("sse2")))
+    inline void fillSSE2(Pixel* dst, uint32_t n, const Gradient& grad){
+        // r0 holds pixels i to i + 3, r1 pixels i + 4 to i + 7
+        __m128i r0 = _mm_setr_epi32(grad.r, grad.r + grad.dr, grad.r + 2 * grad.dr, grad.r + 3 * grad.dr);
+        __m128i g0 = _mm_setr_epi32(grad.g, grad.g + grad.dg, grad.g + 2 * grad.dg, grad.g + 3 * grad.dg);
+        __m128i b0 = _mm_setr_epi32(grad.b, grad.b + grad.db, grad.b + 2 * grad.db, grad.b + 3 * grad.db);
+
+        const __m128i dr4 = _mm_set1_epi32(4 * grad.dr);
+        const __m128i dg4 = _mm_set1_epi32(4 * grad.dg);
+        const __m128i db4 = _mm_set1_epi32(4 * grad.db);
+        const __m128i c8 = _mm_set1_epi8(grad.c);
+
+        uint32_t i = 0;
+        for (; i + 8 <= n; i += 8){
+            const __m128i r1 = _mm_add_epi32(r0, dr4);
+            const __m128i g1 = _mm_add_epi32(g0, dg4);
+            const __m128i b1 = _mm_add_epi32(b0, db4);
+
+            // integer parts, saturated to 0..255 by the packs
+            const __m128i r16 = _mm_packs_epi32(_mm_srai_epi32(r0, 16), _mm_srai_epi32(r1, 16));
+            const __m128i g16 = _mm_packs_epi32(_mm_srai_epi32(g0, 16), _mm_srai_epi32(g1, 16));
+            const __m128i b16 = _mm_packs_epi32(_mm_srai_epi32(b0, 16), _mm_srai_epi32(b1, 16));
+
+            const __m128i rg = _mm_unpacklo_epi8(_mm_packus_epi16(r16, r16), _mm_packus_epi16(g16, g16));
+            const __m128i bc = _mm_unpacklo_epi8(_mm_packus_epi16(b16, b16), c8);
+
+            _mm_storeu_si128((__m128i*)(dst + i), _mm_unpacklo_epi16(rg, bc));
+            _mm_storeu_si128((__m128i*)(dst + i + 4), _mm_unpackhi_epi16(rg, bc));
+
+            r0 = _mm_add_epi32(r1, dr4);
+            g0 = _mm_add_epi32(g1, dg4);
+            b0 = _mm_add_epi32(b1, db4);
+        }
+
+        fillScalar(dst + i, n - i, grad.advanced(i));
+    }
+
+    /* value of each lane is v + lane * d */
+    __attribute__((target("avx2")))
+    inline __m256i start(uint32_t v, uint32_t d, __m256i lane){
+        return _mm256_add_epi32(_mm256_set1_epi32(v), _mm256_mullo_epi32(lane, _mm256_set1_epi32(d)));
+    }
+
+    /* 16 pixels per iteration */
+    __attribute__((target("avx2")))
+    inline void fillAVX2(Pixel* dst, uint32_t n, const Gradient& grad){
+        // the 128 bit halves of the pack / unpack instructions work independently,
+        // so a holds pixels 0-3 and 8-11 and b holds pixels 4-7 and 12-15
+        const __m256i laneA = _mm256_setr_epi32(0, 1, 2, 3, 8, 9, 10, 11);
+        const __m256i laneB = _mm256_setr_epi32(4, 5, 6, 7, 12, 13, 14, 15);
+
+        __m256i rA = start(grad.r, grad.dr, laneA), rB = start(grad.r, grad.dr, laneB);
+        __m256i gA = start(grad.g, grad.dg, laneA), gB = start(grad.g, grad.dg, laneB);
+        __m256i bA = start(grad.b, grad.db, laneA), bB = start(grad.b, grad.db, laneB);
+
+        const __m256i dr16 = _mm256_set1_epi32(16 * grad.dr);
+        const __m256i dg16 = _mm256_set1_epi32(16 * grad.dg);
+        const __m256i db16 = _mm256_set1_epi32(16 * grad.db);
+        const __m256i c8 = _mm256_set1_epi8(grad.c);
+
+        uint32_t i = 0;
+        for (; i + 16 <= n; i += 16){
+            const __m256i r16 = _mm256_packs_epi32(_mm256_srai_epi32(rA, 16), _mm256_srai_epi32(rB, 16));
+            const __m256i g16 = _mm256_packs_epi32(_mm256_srai_epi32(gA, 16), _mm256_srai_epi32(gB, 16));
+            const __m256i b16 = _mm256_packs_epi32(_mm256_srai_epi32(bA, 16), _mm256_srai_epi32(bB, 16));
+
+            const __m256i rg = _mm256_unpacklo_epi8(_mm256_packus_epi16(r16, r16), _mm256_packus_epi16(g16, g16));
+            const __m256i bc = _mm256_unpacklo_epi8(_mm256_packus_epi16(b16, b16), c8);
+
+            const __m256i lo = _mm256_unpacklo_epi16(rg, bc); // pixels 0-3, 8-11
+            const __m256i hi = _mm256_unpackhi_epi16(rg, bc); // pixels 4-7, 12-15
+
+            _mm256_storeu_si256((__m256i*)(dst + i), _mm256_permute2x128_si256(lo, hi, 0x20));
+            _mm256_storeu_si256((__m256i*)(dst + i + 8), _mm256_permute2x128_si256(lo, hi, 0x31));
+
+            rA = _mm256_add_epi32(rA, dr16); rB = _mm256_add_epi32(rB, dr16);
+            gA = _mm256_add_epi32(gA, dg16); gB = _mm256_add_epi32(gB, dg16);
+            bA = _mm256_add_epi32(bA, db16); bB = _mm256_add_epi32(bB, db16);
+        }
+
+        fillSSE2(dst + i, n - i, grad.advanced(i));
+    }
+#endif
+
+    using FillFunction = void (*)(Pixel*, uint32_t, const Gradient&);
+
+    /* picks the widest kernel the cpu supports */
+    inline FillFunction selectFill(){
+        #ifdef SPAN_X86_SIMD
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return fillAVX2;
+            if (__builtin_cpu_supports("sse2"))
+                return fillSSE2;
+        #endif
+        return fillScalar;
+    }
+
+    inline void fill(Pixel* dst, uint32_t n, const Gradient& grad){
+        static const FillFunction kernel = selectFill();
+
+        // short spans are not worth the setup
+        if (n < 8)
+            fillScalar(dst, n, grad);
+        else
+            kernel(dst, n, grad);
+    }
+}
+
+#endif
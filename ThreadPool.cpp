@@ -0,0 +1,126 @@
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#ifndef ThreadPool_cpp
+#define ThreadPool_cpp
+
+/*
+    persistent worker threads for splitting a batch of independent tasks
+
+    every participant starts on its own contiguous share of the task indices and,
+    once that is used up, steals indices from the shares of the others,
+    tasks are claimed with atomic increments so no lock is taken while working
+*/
+class ThreadPool {
+private:
+    /* a participant's share of the task indices, padded so claiming tasks does not bounce cache lines */
+    struct alignas(64) Share {
+        std::atomic<size_t> next{0};
+        size_t end = 0;
+    };
+
+    std::vector<std::thread> workers;
+    std::unique_ptr<Share[]> shares; // one per worker, plus one for the calling thread
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t generation = 0;
+    size_t busy = 0;
+    bool stopping = false;
+
+    const std::function<void(size_t)>* task = nullptr;
+public:
+    /* threads includes the thread that calls run() */
+    explicit ThreadPool(unsigned threads): shares(new Share[threads > 0 ? threads : 1]) {
+        for (unsigned i = 1; i < threads; ++i)
+            workers.emplace_back(&ThreadPool::work, this, i);
+    }
+
+    ~ThreadPool(){
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator= (const ThreadPool&) = delete;
+public:
+    unsigned threads() const {
+        return (unsigned)workers.size() + 1;
+    }
+
+    /* calls fn(i) for every i in [0, count) across all threads, returns once all of them are done */
+    void run(size_t count, const std::function<void(size_t)>& fn){
+        const size_t participants = threads();
+
+        for (size_t i = 0; i < participants; ++i){
+            shares[i].next.store(count * i / participants, std::memory_order_relaxed);
+            shares[i].end = count * (i + 1) / participants;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            task = &fn;
+            busy = workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+
+        process(0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this]{ return busy == 0; });
+        task = nullptr;
+    }
+
+private:
+    void work(size_t index){
+        uint64_t seen = 0;
+
+        while (true){
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&]{ return stopping || generation != seen; });
+
+                if (stopping)
+                    return;
+
+                seen = generation;
+            }
+
+            process(index);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                --busy;
+            }
+            done.notify_one();
+        }
+    }
+
+    void process(size_t index){
+        const size_t participants = threads();
+
+        // own share first, then steal from the others
+        for (size_t k = 0; k < participants; ++k){
+            Share& share = shares[(index + k) % participants];
+
+            size_t i;
+            while ((i = share.next.fetch_add(1, std::memory_order_relaxed)) < share.end)
+                (*task)(i);
+        }
+    }
+};
+
+#endif
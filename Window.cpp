@@ -1,5 +1,11 @@
 #include <array>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string_view>
 
 #ifndef Window_cpp
 #define Window_cpp
@@ -12,12 +18,27 @@
 #endif
 
 #include "Screen.cpp"
+#include "Presenter.cpp"
+#include "Span.cpp"
+#include "ThreadPool.cpp"
+#include "Profiler.cpp"
+#include "Image.cpp"
+
+/*
+    uncomment to interpolate lines, spans, filled rects and scanline triangles with 16.16 fixed point
+    integer steps instead of float lerps, which is deterministic and avoids int <-> float conversions per pixel
+*/
+// #define USE_FIXED_POINT_RASTER
 
 class Window {
 private:
     uint16_t W;
     uint16_t H;
     Screen screen;
+    std::unique_ptr<Presenter> presenter; // set when refreshing on a separate thread
+    std::unique_ptr<ThreadPool> pool; // set when rasterizing on more than one thread
+    FrameSink* sink = nullptr; // set when frames go somewhere other than the terminal
+    bool encodeOffscreen = false; // see setEncodeOffscreen
     struct Point;
     struct Triangle;
     struct Vector2;
@@ -25,12 +46,22 @@ private:
     struct Vector3d;
 
 public:
-    Window(uint16_t width, uint16_t height): W(width), H(height), screen(width, height) {
-        io_write(1, ANSI::SCREEN::PUSH.data, 9);
+    /* fd for windows that are not attached to a terminal, see setSink and frame */
+    static constexpr int OFFSCREEN = -1;
+
+    /* frames go to fd, an OFFSCREEN window does not encode frames at all unless setEncodeOffscreen asks it to */
+    Window(uint16_t width, uint16_t height, int fd = 1): W(width), H(height), screen(width, height) {
+        screen.setOutput(fd);
+
+        if (fd >= 0)
+            io_write(fd, ANSI::SCREEN::PUSH.data, 9);
     }
 
     ~Window(){
-        io_write(1, ANSI::SCREEN::POP.data, 9);
+        presenter.reset(); // let the last frame go out before leaving the alternate screen
+
+        if (screen.output() >= 0)
+            io_write(screen.output(), ANSI::SCREEN::POP.data, 9);
     }
 public:
     uint16_t width(){
@@ -40,94 +71,126 @@ public:
         return H;
     }
 private:
-public: /* draw functions */ 
-    void drawPoint(const Point2d& point){
-        screen[point.x][point.y] = point;
+public: /* depth testing */
+    /*
+        with depth testing enabled a pixel is only written if it is at least as close as what is already there
+        the depth buffer is reset by clear(), points without a depth (z = 0) count as infinitely far away
+    */
+    void setDepthTest(bool enable){
+        screen.enableDepth(enable);
     }
 
-    void drawXLine(Point2d a, Point2d b){
-        if (a.x > b.x){ auto temp = a; a = b; b = temp; } // sort them
+private:
+    /* tests and updates the depth buffer, always passes if depth testing is disabled */
+    bool depthPass(uint16_t x, uint16_t y, float z){
+        float* depth = screen.depthRow(y);
 
-        const float diffX = (float)b.x - (float)a.x;
-       
-        const float diffR = (float)b.r - (float)a.r;
-        const float diffG = (float)b.g - (float)a.g;
-        const float diffB = (float)b.b - (float)a.b;
-
-        if (!diffX){
-            screen[a.x][a.y] = Pixel (
-                a.c,
-                (float)(a.r + b.r) / 2.0f,
-                (float)(a.g + b.g) / 2.0f,
-                (float)(a.b + b.b) / 2.0f
-            );
-        }
+        if (!depth)
+            return true;
+        if (z < depth[x])
+            return false;
 
-        else {
-            for (uint16_t i = a.x; i <= b.x; ++i)
-                screen[i][a.y] = Pixel(
-                    a.c,
-                    a.r + (((float)i - (float)a.x) / (float)diffX) * (float)diffR,
-                    a.g + (((float)i - (float)a.x) / (float)diffX) * (float)diffG,
-                    a.b + (((float)i - (float)a.x) / (float)diffX) * (float)diffB
-                );
-        }
+        depth[x] = z;
+        return true;
     }
 
-    void drawYLine(Point2d a, Point2d b){
-        if (a.y > b.y){ auto temp = a; a = b; b = temp; } // sort the points
-        
-        const float diffY = (float)b.y - (float)a.y;
-        const float diffR = (float)b.r - (float)a.r;
-        const float diffG = (float)b.g - (float)a.g;
-        const float diffB = (float)b.b - (float)a.b;
-
-        for (uint16_t i = a.y; i <= b.y; ++i){
-            const float lerpFactor = (((float)i - (float)a.x) / (float)diffY);
-            screen[a.x][i] = Pixel (
-                a.c,
-                a.r + (float)lerpFactor * (float)diffR,
-                a.g + (float)lerpFactor * (float)diffG,
-                a.b + (float)lerpFactor * (float)diffB
-            );
-        }
+    /* drawPoint without the bounds check, for loops that were clipped to the screen already */
+    void plot(const Point2d& point){
+        if (depthPass(point.x, point.y, point.z))
+            screen[point.x][point.y] = point;
     }
 
-    void drawLine(const Point2d& a, const Point2d& b){ 
-        uint16_t x = a.x;
-        uint16_t y = a.y;
-        
-        const float distance = sqrtf((float)pow((float)b.x - (float)a.x, 2) + (float)pow((float)b.y - (float)a.y, 2));
-        
-        const float diffR = (float)b.r - (float)a.r;
-        const float diffG = (float)b.g - (float)a.g;
-        const float diffB = (float)b.b - (float)a.b;
+public: /* triangle rasterizer selection */
+    enum class Rasterizer {
+        Scanline,    // splits triangles into flat top / flat bottom halves
+        EdgeFunction // half-space tests over 8x8 tiles, colors stepped by barycentric deltas
+    };
+
+    void setRasterizer(Rasterizer r){
+        rasterizer = r;
+    }
+
+private:
+    Rasterizer rasterizer = Rasterizer::Scanline;
+
+public: /* line style */
+    enum class LineStyle {
+        Aliased,    // Bresenham, one pixel per step along the major axis
+        Antialiased // Xiaolin Wu, two pixels per step blended into what is already on screen
+    };
+
+    /* used by drawLine, drawLines and every outline (drawTri / drawPoly with fill = false) */
+    void setLineStyle(LineStyle style){
+        lineStyle = style;
+    }
+
+private:
+    LineStyle lineStyle = LineStyle::Aliased;
+
+    void stroke(const Point2d& a, const Point2d& b){
+        // antialiased lines also blend into the pixels next to the ones they pass through
+        const int32_t spill = lineStyle == LineStyle::Antialiased ? 1 : 0;
+        screen.markDirty(
+            std::min(a.x, b.x) - spill, std::min(a.y, b.y) - spill,
+            std::max(a.x, b.x) + spill, std::max(a.y, b.y) + spill
+        );
+
+        if (lineStyle == LineStyle::Antialiased)
+            smoothLine(a, b);
+        else
+            line(a, b);
+    }
+
+    /*
+        Bresenham, only the part on screen is walked but colors are still interpolated along all of a -> b,
+        every step moves one pixel along the major axis so colors and depth are stepped by a constant
+    */
+    void line(const Point2d& a, const Point2d& b){
+        Point2d from = a, to = b;
+        if (!clipLine(from, to))
+            return;
+
+        int32_t x = from.x;
+        int32_t y = from.y;
+
+        const int32_t dX = abs(to.x - from.x);
+        const int32_t dY = abs(to.y - from.y);
 
+        const int32_t sX = (from.x < to.x) ? 1 : -1;
+        const int32_t sY = (from.y < to.y) ? 1 : -1;
 
-        int dX = abs((long double)b.x - a.x);
-        int dY = abs((long double)b.y - a.y);
+        int32_t err = dX - dY;
 
-        int sX = (a.x < b.x) ? 1 : -1;
-        int sY = (a.y < b.y) ? 1 : -1;
+        PROFILE_COUNT(Pixels, std::max(dX, dY) + 1);
 
-        int err = dX - dY;
+        const int32_t steps = std::max(abs(b.x - a.x), abs(b.y - a.y));
+        const int32_t skipped = std::max(abs(from.x - a.x), abs(from.y - a.y));
+
+        const float dz = steps ? (b.z - a.z) / (float)steps : 0.0f;
+        float z = a.z + (float)skipped * dz;
+
+        #ifdef USE_FIXED_POINT_RASTER
+            Span::Gradient color = Span::Gradient::between(a, b, steps + 1).advanced(skipped);
+        #else
+            const float dr = steps ? ((float)b.r - (float)a.r) / (float)steps : 0.0f;
+            const float dg = steps ? ((float)b.g - (float)a.g) / (float)steps : 0.0f;
+            const float db = steps ? ((float)b.b - (float)a.b) / (float)steps : 0.0f;
+            float r = a.r + (float)skipped * dr, g = a.g + (float)skipped * dg, b_ = a.b + (float)skipped * db;
+        #endif
 
         while (true) {
+            #ifdef USE_FIXED_POINT_RASTER
+                plot({ Span::channel(color.r), Span::channel(color.g), Span::channel(color.b), x, y, a.c, z });
+                color.step();
+            #else
+                plot({ (uint8_t)r, (uint8_t)g, (uint8_t)b_, x, y, a.c, z });
+                r += dr; g += dg; b_ += db;
+            #endif
+            z += dz;
 
-            float lerpFactor = sqrtf((float)pow((float)x - (float)a.x, 2) + (float)pow((float)y - (float)a.y, 2)) / distance;
-            float r = (float)a.r + ((float)lerpFactor * (float)diffR);
-            float g = (float)a.g + ((float)lerpFactor * (float)diffG);
-            float b_ = (float)a.b + ((float)lerpFactor * (float)diffB);
-            drawPoint({
-                (uint8_t)(r),
-                (uint8_t)(g),
-                (uint8_t)(b_),
-                x, y, a.c
-            });
-            
-            if (x == b.x && y == b.y) break;
+            if (x == to.x && y == to.y) break;
 
-            int e2 = 2 * err;
+            const int32_t e2 = 2 * err;
 
             if (e2 > -dY) {
                 err -= dY;
@@ -140,12 +203,205 @@ public: /* draw functions */
             }
         }
     }
+
+    /*
+        Xiaolin Wu, for every step along the major axis the exact position on the minor axis is shared
+        between the two pixels next to it, each blended in by how close the line passes
+        the glyph of a pixel is only replaced where the line covers at least half of it
+    */
+    void smoothLine(const Point2d& a, const Point2d& b){
+        Point2d from = a, to = b;
+        if (!clipLine(from, to))
+            return;
+
+        const bool steep = abs(to.y - from.y) > abs(to.x - from.x);
+        const int32_t major0 = steep ? from.y : from.x, major1 = steep ? to.y : to.x;
+        const int32_t minor0 = steep ? from.x : from.y, minor1 = steep ? to.x : to.y;
+
+        const int32_t n = abs(major1 - major0);
+        const int32_t sMajor = major0 < major1 ? 1 : -1;
+        const float slope = n ? (float)(minor1 - minor0) / (float)n : 0.0f;
+
+        PROFILE_COUNT(Pixels, 2 * (n + 1));
+
+        const int32_t steps = std::max(abs(b.x - a.x), abs(b.y - a.y));
+        const int32_t skipped = std::max(abs(from.x - a.x), abs(from.y - a.y));
+        const float inv = steps ? 1.0f / (float)steps : 0.0f;
+
+        const float dr = ((float)b.r - (float)a.r) * inv, dg = ((float)b.g - (float)a.g) * inv, db = ((float)b.b - (float)a.b) * inv;
+        const float dz = (b.z - a.z) * inv;
+        float r = a.r + (float)skipped * dr, g = a.g + (float)skipped * dg, b_ = a.b + (float)skipped * db;
+        float z = a.z + (float)skipped * dz;
+        float minor = (float)minor0;
+
+        for (int32_t i = 0, major = major0; i <= n; ++i, major += sMajor){
+            const float base = floorf(minor);
+            const float coverage = minor - base;
+
+            blend(steep, major, (int32_t)base, a.c, r, g, b_, z, 1.0f - coverage);
+            blend(steep, major, (int32_t)base + 1, a.c, r, g, b_, z, coverage);
+
+            minor += slope;
+            r += dr; g += dg; b_ += db;
+            z += dz;
+        }
+    }
+
+    void blend(bool steep, int32_t major, int32_t minor, char c, float r, float g, float b, float z, float coverage){
+        const int32_t x = steep ? minor : major, y = steep ? major : minor;
+
+        if (coverage <= 0.0f || (uint32_t)x >= W || (uint32_t)y >= H || !depthPass(x, y, z))
+            return;
+
+        Pixel& p = screen[x][y];
+        p = Pixel(
+            coverage >= 0.5f ? c : p.c,
+            (uint8_t)(p.r + (r - p.r) * coverage),
+            (uint8_t)(p.g + (g - p.g) * coverage),
+            (uint8_t)(p.b + (b - p.b) * coverage)
+        );
+    }
+
+public: /* draw functions */ 
+    /*
+        every draw function clips to the screen, points may lie anywhere in the range of a Point2d
+        the clipping happens once per line / row / triangle so the pixel loops themselves are unchecked
+    */
+    void drawPoint(const Point2d& point){
+        if ((uint32_t)point.x < W && (uint32_t)point.y < H){
+            PROFILE_COUNT(Pixels, 1);
+            screen.markDirty(point.x, point.y, point.x, point.y);
+            plot(point);
+        }
+    }
+
+    void drawXLine(Point2d a, Point2d b){
+        if (a.x > b.x){ auto temp = a; a = b; b = temp; } // sort them
+
+        if ((uint32_t)a.y >= H || b.x < 0 || a.x >= W)
+            return;
+
+        screen.markDirty(a.x, a.y, b.x, a.y);
+
+        if (a.x == b.x){
+            PROFILE_COUNT(Pixels, 1);
+
+            if (depthPass(a.x, a.y, std::max(a.z, b.z)))
+                screen[a.x][a.y] = Pixel (
+                    a.c,
+                    (float)(a.r + b.r) / 2.0f,
+                    (float)(a.g + b.g) / 2.0f,
+                    (float)(a.b + b.b) / 2.0f
+                );
+        }
+
+        else {
+            const uint32_t n = b.x - a.x + 1;
+            const float dz = (b.z - a.z) / (float)(n - 1);
+
+            // the part that is off screen on the left is skipped by advancing the start values
+            const int32_t x0 = std::max<int32_t>(a.x, 0);
+            const int32_t x1 = std::min<int32_t>(b.x, W - 1);
+            const uint32_t skipped = x0 - a.x;
+
+            const Span::Gradient gradient = Span::Gradient::between(a, b, n).advanced(skipped);
+
+            Pixel* row = screen.row(a.y) + x0;
+            float* depth = screen.depthRow(a.y);
+
+            PROFILE_COUNT(Pixels, x1 - x0 + 1);
+
+            // hidden pixels are rejected before their color is written
+            if (depth)
+                Span::fillDepthTested(row, depth + x0, x1 - x0 + 1, gradient, a.z + (float)skipped * dz, dz);
+            else
+                Span::fill(row, x1 - x0 + 1, gradient);
+        }
+    }
+
+    void drawYLine(Point2d a, Point2d b){
+        if (a.y > b.y){ auto temp = a; a = b; b = temp; } // sort the points
+
+        if ((uint32_t)a.x >= W || b.y < 0 || a.y >= H)
+            return;
+
+        screen.markDirty(a.x, a.y, a.x, b.y);
+
+        const int32_t steps = b.y - a.y;
+        const int32_t y0 = std::max<int32_t>(a.y, 0);
+        const int32_t y1 = std::min<int32_t>(b.y, H - 1);
+        const int32_t skipped = y0 - a.y;
+
+        PROFILE_COUNT(Pixels, std::max(y1 - y0 + 1, 0));
+
+        // colors and depth are stepped once per pixel, starting at the first pixel on screen
+        const float dz = steps ? (b.z - a.z) / (float)steps : 0.0f;
+        float z = a.z + (float)skipped * dz;
+
+        #ifdef USE_FIXED_POINT_RASTER
+            Span::Gradient color = Span::Gradient::between(a, b, steps + 1).advanced(skipped);
+        #else
+            const float dr = steps ? ((float)b.r - (float)a.r) / (float)steps : 0.0f;
+            const float dg = steps ? ((float)b.g - (float)a.g) / (float)steps : 0.0f;
+            const float db = steps ? ((float)b.b - (float)a.b) / (float)steps : 0.0f;
+            float r = a.r + (float)skipped * dr, g = a.g + (float)skipped * dg, b_ = a.b + (float)skipped * db;
+        #endif
+
+        for (int32_t i = y0; i <= y1; ++i){
+            #ifdef USE_FIXED_POINT_RASTER
+                const Pixel pixel(a.c, Span::channel(color.r), Span::channel(color.g), Span::channel(color.b));
+                color.step();
+            #else
+                const Pixel pixel(a.c, (uint8_t)r, (uint8_t)g, (uint8_t)b_);
+                r += dr; g += dg; b_ += db;
+            #endif
+
+            if (depthPass(a.x, i, z))
+                screen[a.x][i] = pixel;
+            z += dz;
+        }
+    }
+
+    void drawLine(const Point2d& a, const Point2d& b){
+        PROFILE_SCOPE(Raster);
+        stroke(a, b);
+    }
+
+    /*
+        draws count segments, segment i goes from vertices[indices[2 * i]] to vertices[indices[2 * i + 1]],
+        for wireframes of big models, where drawing one line at a time is mostly call overhead
+    */
+    void drawLines(const Point2d* vertices, const uint32_t* indices, size_t count){
+        PROFILE_SCOPE(Raster);
+
+        for (size_t i = 0; i < count; ++i)
+            stroke(vertices[indices[2 * i]], vertices[indices[2 * i + 1]]);
+    }
+
     /* 
         assumes that points are in clockwise order 
         a.y == b.y && b.x == c.x && c.y = d.y && d.x == a.x
     */
     void drawRect(const Point2d& a, const Point2d& b, const Point2d& c, const Point2d& d, bool fill){
+        PROFILE_SCOPE(Raster);
+
         if (fill){  
+        #ifdef USE_FIXED_POINT_RASTER
+            const int32_t y0 = std::max<int32_t>(a.y, 0);
+
+            // vertical A to D and B to C colors, one step per row
+            Span::Gradient left = Span::Gradient::between(a, d, d.y - a.y + 1).advanced(y0 - a.y);
+            Span::Gradient right = Span::Gradient::between(b, c, d.y - a.y + 1).advanced(y0 - a.y);
+
+            for (int32_t i = y0; i <= std::min<int32_t>(d.y, H - 1); ++i){
+                drawXLine(
+                    { Span::channel(left.r), Span::channel(left.g), Span::channel(left.b), a.x, i },
+                    { Span::channel(right.r), Span::channel(right.g), Span::channel(right.b), b.x, i }
+                );
+                left.step();
+                right.step();
+            }
+        #else
             const float diffY = (float)d.y - (float)a.y;
 
             // vertical A to D lerp constants
@@ -158,7 +414,7 @@ public: /* draw functions */
             const float BCdiffG = (float)c.g - (float)b.g;
             const float BCdiffB = (float)c.b - (float)b.b;
 
-            for (uint16_t i = a.y; i <= d.y; ++i){
+            for (int32_t i = std::max<int32_t>(a.y, 0); i <= std::min<int32_t>(d.y, H - 1); ++i){
                 float lerpFactorA = ((float)i - (float)a.y) / (float)diffY;
                 float lerpFactorB = ((float)i - (float)b.y) / (float)diffY;
                 drawXLine(
@@ -177,7 +433,7 @@ public: /* draw functions */
                     /* y */i
                 }); 
             }
-
+        #endif
         }
         else {
             // since points are already in order, we can just draw lines
@@ -190,14 +446,28 @@ public: /* draw functions */
     }
 
     void drawRect(const Point2d& a, const Point2d& b, bool fill){
+        PROFILE_SCOPE(Raster);
+
         if (fill){
+        #ifdef USE_FIXED_POINT_RASTER
+            const int32_t y0 = std::max<int32_t>(a.y, 0);
+
+            // both ends of a row have the same color, stepped once per row
+            Span::Gradient color = Span::Gradient::between(a, b, b.y - a.y + 1).advanced(y0 - a.y);
+
+            for (int32_t i = y0; i <= std::min<int32_t>(b.y, H - 1); ++i){
+                const uint8_t r = Span::channel(color.r), g = Span::channel(color.g), b_ = Span::channel(color.b);
+                drawXLine({ r, g, b_, a.x, i }, { r, g, b_, b.x, i });
+                color.step();
+            }
+        #else
             const float diffY = (float)b.y - (float)a.y;
             // vertical A to B lerp constants
             const float ABdiffR = (float)b.r - (float)a.r;
             const float ABdiffG = (float)b.g - (float)a.g;
             const float ABdiffB = (float)b.b - (float)a.b;
 
-            for (uint16_t i = a.y; i <= b.y; ++i){
+            for (int32_t i = std::max<int32_t>(a.y, 0); i <= std::min<int32_t>(b.y, H - 1); ++i){
                 float lerpFactorA = ((float)i - (float)a.y) / (float)diffY;
                 float lerpFactorB = ((float)i - (float)b.y) / (float)diffY;
                 drawXLine(
@@ -216,6 +486,7 @@ public: /* draw functions */
                     /* y */i
                 }); 
             }
+        #endif
         }
         else{
             drawXLine({
@@ -253,12 +524,30 @@ public: /* draw functions */
     }
 
     void drawTri(Point2d a, Point2d b, Point2d c, bool fill){
+        PROFILE_SCOPE(Raster);
+        PROFILE_COUNT(Triangles, 1);
+
+        if (fill)
+            screen.markDirty(std::min({a.x, b.x, c.x}), std::min({a.y, b.y, c.y}), std::max({a.x, b.x, c.x}), std::max({a.y, b.y, c.y}));
+
         if (!fill){
-            drawLine(a, b);
-            drawLine(b, c);
-            drawLine(c, a);
+            stroke(a, b);
+            stroke(b, c);
+            stroke(c, a);
+        }
+        else
+        if (rasterizer == Rasterizer::EdgeFunction){
+            rasterTri(a, b, c, {0, 0, (uint16_t)(W - 1), (uint16_t)(H - 1)});
         }
         else {
+            const Rect bounds = {0, 0, (uint16_t)(W - 1), (uint16_t)(H - 1)};
+
+            // the scanline loops below assume the whole triangle is on screen
+            if (!bounds.contains(a.x, a.y) || !bounds.contains(b.x, b.y) || !bounds.contains(c.x, c.y)){
+                drawClippedTri(a, b, c);
+                return;
+            }
+
             // sort by y coordinate
             if (a.y > b.y){ auto temp = a; a = b; b = temp; }
             if (a.y > c.y){ auto temp = a; a = c; c = temp; }
@@ -282,9 +571,10 @@ public: /* draw functions */
                 uint8_t r = (float)a.r + (float)lerpFactor * ((float)c.r - (float)a.r);
                 uint8_t g = (float)a.g + (float)lerpFactor * ((float)c.g - (float)a.g);
                 uint8_t b_ = (float)a.b + (float)lerpFactor * ((float)c.b - (float)a.b);
+                float z = a.z + lerpFactor * (c.z - a.z);
 
-                fillFlatTop(c, {r, g, b_, x, b.y}, b);
-                fillFlatBottom(a, {r, g, b_, x, b.y}, b);
+                fillFlatTop(c, {r, g, b_, x, b.y, a.c, z}, b);
+                fillFlatBottom(a, {r, g, b_, x, b.y, a.c, z}, b);
             } else
             // bend on right
             if (b.x > c.x){
@@ -294,15 +584,18 @@ public: /* draw functions */
                 uint8_t r = (float)a.r + (float)lerpFactor * ((float)c.r - (float)a.r);
                 uint8_t g = (float)a.g + (float)lerpFactor * ((float)c.g - (float)a.g);
                 uint8_t b_ = (float)a.b + (float)lerpFactor * ((float)c.b - (float)a.b);
+                float z = a.z + lerpFactor * (c.z - a.z);
 
-                fillFlatTop(c, {r, g, b_, x, b.y}, b);
-                fillFlatBottom(a, {r, g, b_, x, b.y}, b);
+                fillFlatTop(c, {r, g, b_, x, b.y, a.c, z}, b);
+                fillFlatBottom(a, {r, g, b_, x, b.y, a.c, z}, b);
             }
         }
     }
 
     template<typename ... Args>
     void drawPoly(bool fill, Args&&... args){
+        PROFILE_SCOPE(Raster);
+
         std::array<Point2d, (sizeof ...(args))> points = { (Point2d)(args)... };
         if (fill){
             for (Vector3& tri : polyTriSplit(points)){
@@ -311,100 +604,372 @@ public: /* draw functions */
         }
         else {
             for (uint16_t i = 0; i < points.size() - 1; ++i)
-                drawLine(points[i], points[i + 1]);
-            
-            drawLine(points[points.size() - 1], points[0]);
+                stroke(points[i], points[i + 1]);
+
+            stroke(points[points.size() - 1], points[0]);
+        }
+    }
+
+    /*
+        splits the filled polygon vertices[face[0]], vertices[face[1]], ... into triangles
+        and appends their vertex indices to out (see drawTriangles)
+    */
+    template<size_t S>
+    void triangulatePoly(const Point2d* vertices, const std::array<uint32_t, S>& face, std::vector<uint32_t>& out){
+        std::array<Point2d, S> points;
+        for (size_t i = 0; i < S; ++i)
+            points[i] = vertices[face[i]];
+
+        for (Vector3& tri : polyTriSplit(points)){
+            out.push_back(face[tri.a]);
+            out.push_back(face[tri.b]);
+            out.push_back(face[tri.c]);
+        }
+    }
+
+private: /* clipping to the screen */
+    /*
+        Cohen-Sutherland, moves a and b along the line between them until both are on screen,
+        only the positions change, returns false if no part of the line is on screen
+    */
+    bool clipLine(Point2d& a, Point2d& b) const {
+        enum : uint8_t { LEFT = 1, RIGHT = 2, TOP = 4, BOTTOM = 8 };
+
+        const float maxX = W - 1, maxY = H - 1;
+        auto outcode = [=](float x, float y){
+            return (uint8_t)((x < 0.0f ? LEFT : x > maxX ? RIGHT : 0) | (y < 0.0f ? TOP : y > maxY ? BOTTOM : 0));
+        };
+
+        float x0 = a.x, y0 = a.y, x1 = b.x, y1 = b.y;
+        uint8_t code0 = outcode(x0, y0), code1 = outcode(x1, y1);
+
+        if (!(code0 | code1))
+            return true;
+
+        while (code0 | code1){
+            if (code0 & code1)
+                return false;
+
+            const uint8_t code = code0 ? code0 : code1;
+            float x, y;
+
+            if (code & LEFT)  { x = 0.0f; y = y0 + (y1 - y0) * (x - x0) / (x1 - x0); } else
+            if (code & RIGHT) { x = maxX; y = y0 + (y1 - y0) * (x - x0) / (x1 - x0); } else
+            if (code & TOP)   { y = 0.0f; x = x0 + (x1 - x0) * (y - y0) / (y1 - y0); }
+            else              { y = maxY; x = x0 + (x1 - x0) * (y - y0) / (y1 - y0); }
+
+            if (code == code0){ x0 = x; y0 = y; code0 = outcode(x0, y0); }
+            else              { x1 = x; y1 = y; code1 = outcode(x1, y1); }
         }
+
+        a.x = (int16_t)roundf(x0); a.y = (int16_t)roundf(y0);
+        b.x = (int16_t)roundf(x1); b.y = (int16_t)roundf(y1);
+        return true;
+    }
+
+    /*
+        Sutherland-Hodgman against the 4 screen edges, the polygon that is left is
+        filled as a fan of triangles that are entirely on screen
+    */
+    void drawClippedTri(const Point2d& a, const Point2d& b, const Point2d& c){
+        struct Vertex { float x, y, r, g, b, z; };
+
+        auto vertex = [](const Point2d& p){
+            return Vertex{ (float)p.x, (float)p.y, (float)p.r, (float)p.g, (float)p.b, p.z };
+        };
+
+        // every edge adds at most one vertex
+        Vertex polygon[7] = { vertex(a), vertex(b), vertex(c) }, next[7];
+        size_t n = 3;
+
+        const float maxX = W - 1, maxY = H - 1;
+
+        for (int edge = 0; edge < 4 && n; ++edge){
+            // distance to the edge, negative outside
+            auto inside = [=](const Vertex& v){
+                switch (edge){
+                    case 0:  return v.x;
+                    case 1:  return maxX - v.x;
+                    case 2:  return v.y;
+                    default: return maxY - v.y;
+                }
+            };
+
+            size_t m = 0;
+            for (size_t i = 0; i < n; ++i){
+                const Vertex& p = polygon[i];
+                const Vertex& q = polygon[(i + 1) % n];
+                const float dp = inside(p), dq = inside(q);
+
+                if (dp >= 0.0f)
+                    next[m++] = p;
+
+                if ((dp >= 0.0f) != (dq >= 0.0f)){
+                    const float t = dp / (dp - dq);
+                    next[m++] = {
+                        p.x + t * (q.x - p.x), p.y + t * (q.y - p.y),
+                        p.r + t * (q.r - p.r), p.g + t * (q.g - p.g), p.b + t * (q.b - p.b),
+                        p.z + t * (q.z - p.z)
+                    };
+                }
+            }
+
+            std::copy(next, next + m, polygon);
+            n = m;
+        }
+
+        if (n < 3)
+            return;
+
+        Point2d points[7];
+        for (size_t i = 0; i < n; ++i){
+            const Vertex& v = polygon[i];
+            points[i] = {
+                (uint8_t)roundf(v.r), (uint8_t)roundf(v.g), (uint8_t)roundf(v.b),
+                (int32_t)std::min(std::max(roundf(v.x), 0.0f), maxX),
+                (int32_t)std::min(std::max(roundf(v.y), 0.0f), maxY),
+                a.c, v.z
+            };
+        }
+
+        for (size_t i = 1; i + 1 < n; ++i)
+            drawTri(points[0], points[i], points[i + 1], true);
+    }
+
+public: /* batched triangles */
+    /*
+        draws count triangles, triangle i is made of vertices[indices[3 * i]], [3 * i + 1] and [3 * i + 2]
+
+        with more than one thread (see setThreads) big batches of filled triangles are sorted into
+        screen tiles which are rasterized in parallel with the edge function rasterizer,
+        tiles do not overlap so no locking is needed, and within a tile triangles are still drawn in order
+    */
+    void drawTriangles(const Point2d* vertices, const uint32_t* indices, size_t count, bool fill){
+        PROFILE_SCOPE(Raster);
+
+        if (!fill || !pool || count < MIN_BINNED_TRIANGLES){
+            for (size_t i = 0; i < count; ++i)
+                drawTri(vertices[indices[3 * i]], vertices[indices[3 * i + 1]], vertices[indices[3 * i + 2]], fill);
+            return;
+        }
+
+        binsX = (W + BIN_SIZE - 1) / BIN_SIZE;
+        const uint16_t binsY = (H + BIN_SIZE - 1) / BIN_SIZE;
+        const size_t binCount = (size_t)binsX * binsY;
+
+        // counting sort into one flat list, first count the triangles per bin, then place them,
+        // both buffers keep their capacity from earlier batches so a steady scene does not allocate
+        binStart.assign(binCount + 1, 0);
+
+        for (size_t i = 0; i < count; ++i){
+            Rect box;
+            if (!binBounds(vertices, indices, i, box)) continue;
+
+            screen.markDirty(box.x0, box.y0, box.x1, box.y1);
+
+            for (uint16_t by = box.y0 / BIN_SIZE; by <= box.y1 / BIN_SIZE; ++by)
+                for (uint16_t bx = box.x0 / BIN_SIZE; bx <= box.x1 / BIN_SIZE; ++bx)
+                    ++binStart[(size_t)by * binsX + bx + 1];
+        }
+
+        for (size_t bin = 0; bin < binCount; ++bin)
+            binStart[bin + 1] += binStart[bin];
+
+        if (binned.size() < binStart[binCount])
+            binned.resize(binStart[binCount]);
+        binFill.assign(binStart.begin(), binStart.end() - 1);
+
+        for (size_t i = 0; i < count; ++i){
+            Rect box;
+            if (!binBounds(vertices, indices, i, box)) continue;
+
+            for (uint16_t by = box.y0 / BIN_SIZE; by <= box.y1 / BIN_SIZE; ++by)
+                for (uint16_t bx = box.x0 / BIN_SIZE; bx <= box.x1 / BIN_SIZE; ++bx)
+                    binned[binFill[(size_t)by * binsX + bx]++] = (uint32_t)i;
+        }
+
+        PROFILE_COUNT(Triangles, count);
+
+        activeBins.clear();
+        for (uint32_t bin = 0; bin < binCount; ++bin)
+            if (binStart[bin + 1] > binStart[bin])
+                activeBins.push_back(bin);
+
+        binnedVertices = vertices;
+        binnedIndices = indices;
+        pool->run(activeBins.size(), [this](size_t k){ rasterBin(activeBins[k]); });
+        binnedVertices = nullptr;
+        binnedIndices = nullptr;
+    }
+
+    /* 0 uses every hardware thread, 1 rasterizes on the calling thread only */
+    void setThreads(unsigned threads){
+        if (threads == 0)
+            threads = std::max(1u, std::thread::hardware_concurrency());
+
+        pool.reset();
+        if (threads > 1)
+            pool = std::make_unique<ThreadPool>(threads);
+    }
+
+private: /* tile binning */
+    static constexpr uint16_t BIN_SIZE = 32; // multiple of TILE_SIZE, so bins line up with the rasterizer's tiles
+    static constexpr size_t MIN_BINNED_TRIANGLES = 32; // smaller batches are not worth waking the workers
+
+    std::vector<uint32_t> binned; // triangle indices of every bin, bins are row-major
+    std::vector<uint32_t> binStart; // bin b holds binned[binStart[b]] up to binned[binStart[b + 1]]
+    std::vector<uint32_t> binFill; // next free slot of each bin while placing
+    std::vector<uint32_t> activeBins;
+    uint16_t binsX = 0;
+    const Point2d* binnedVertices = nullptr;
+    const uint32_t* binnedIndices = nullptr;
+
+    void rasterBin(uint32_t bin){
+        const uint16_t x0 = bin % binsX * BIN_SIZE;
+        const uint16_t y0 = bin / binsX * BIN_SIZE;
+        const Rect clip = {
+            x0, y0,
+            (uint16_t)std::min<int32_t>(x0 + BIN_SIZE - 1, W - 1),
+            (uint16_t)std::min<int32_t>(y0 + BIN_SIZE - 1, H - 1)
+        };
+
+        for (uint32_t k = binStart[bin]; k < binStart[bin + 1]; ++k){
+            const uint32_t i = binned[k];
+            rasterTri(
+                binnedVertices[binnedIndices[3 * i]],
+                binnedVertices[binnedIndices[3 * i + 1]],
+                binnedVertices[binnedIndices[3 * i + 2]],
+                clip
+            );
+        }
+    }
+
+    /* on screen bounding box of triangle i, false if it is entirely off screen */
+    bool binBounds(const Point2d* vertices, const uint32_t* indices, size_t i, Rect& box) const {
+        const Point2d& a = vertices[indices[3 * i]];
+        const Point2d& b = vertices[indices[3 * i + 1]];
+        const Point2d& c = vertices[indices[3 * i + 2]];
+
+        const int32_t minX = std::max<int32_t>(std::min({a.x, b.x, c.x}), 0);
+        const int32_t minY = std::max<int32_t>(std::min({a.y, b.y, c.y}), 0);
+        const int32_t maxX = std::min<int32_t>(std::max({a.x, b.x, c.x}), W - 1);
+        const int32_t maxY = std::min<int32_t>(std::max({a.y, b.y, c.y}), H - 1);
+
+        if (minX > maxX || minY > maxY) return false;
+
+        box = { (uint16_t)minX, (uint16_t)minY, (uint16_t)maxX, (uint16_t)maxY };
+        return true;
     }
 
 private: /* drawPoly helper function */
+    /*
+        splits a simple polygon into S - 2 triangles of indices into points, without allocating
+
+        convex polygons, by far the most common, are fanned around their last vertex,
+        anything else goes through an ear clipper that keeps the remaining vertices in a linked list
+        and only tests the reflex ones against a candidate ear, since only those can lie inside it,
+        self-intersecting and degenerate polygons still give S - 2 triangles, just not a sensible split,
+        every triangle keeps the winding of the polygon, so backface culling sees the same facing either way
+    */
     template<size_t S, size_t V = S - 2>
     std::array<Vector3, V> polyTriSplit(const std::array<Point2d, S>& points){
-        std::vector<size_t> iList(S);
+        PROFILE_SCOPE(Triangulation);
 
+        std::array<Vector3, V> triangles;
+
+        // sign of the shoelace sum, so turns can be told apart from reflex vertices whatever the winding
+        int64_t area = 0;
         for (size_t i = 0; i < S; ++i)
-            iList[i] = i;
+            area += crossProduct(points[i], points[(i + 1) % S]);
+        const int64_t winding = area < 0 ? -1 : 1;
 
-        std::array<Vector3, V> triangles;
-        size_t triCount = 0;
+        bool convex = true;
+        for (size_t i = 0; i < S && convex; ++i)
+            convex = turn(points[(i + S - 1) % S], points[i], points[(i + 1) % S]) * winding >= 0;
+
+        if (convex){
+            for (size_t i = 0; i < V; ++i)
+                triangles[i] = Vector3(S - 1, i, i + 1);
+            return triangles;
+        }
 
-        while (iList.size() > 3){
-            for (size_t i = 0; i < iList.size(); ++i){
-                size_t a = iList[i];
-                size_t b = getItem(iList, i - 1);
-                size_t c = getItem(iList, i + 1);
+        std::array<size_t, S> prev, next;
+        std::array<bool, S> reflex;
 
-                Vector2 vecA = points[a];
-                Vector2 vecB = points[b];
-                Vector2 vecC = points[c];
+        for (size_t i = 0; i < S; ++i){
+            prev[i] = (i + S - 1) % S;
+            next[i] = (i + 1) % S;
+        }
 
-                Vector2 vecAtoB = vecB - vecA;
-                Vector2 vecAtoC = vecC - vecA;
+        // collinear vertices count as reflex, they can not be clipped without a zero area ear
+        auto updateReflex = [&](size_t i){
+            reflex[i] = turn(points[prev[i]], points[i], points[next[i]]) * winding <= 0;
+        };
+        for (size_t i = 0; i < S; ++i)
+            updateReflex(i);
 
-                if (crossProduct(vecAtoB, vecAtoC) > 0.0f)
-                    continue;
-                else{
-                    bool isEar = true;
-                    for (size_t j = 0; j < S; ++j){
-                        if (j == a || j == b || j == c)
-                            continue;
-                        else {
-                            Vector2 point = points[j];
-
-                            if (pointInTriangle(point, vecB, vecA, vecC)){
-                                isEar = false;
-                            }
-                        }
+        auto isEar = [&](size_t i){
+            if (reflex[i])
+                return false;
 
-                    }
+            const Vector2 a = points[prev[i]], b = points[i], c = points[next[i]];
+            for (size_t j = next[next[i]]; j != prev[i]; j = next[j])
+                if (reflex[j] && pointInTriangle(points[j], a, b, c, winding))
+                    return false;
+            return true;
+        };
 
-                    if (isEar){
-                        triangles[triCount++] = Vector3(a, b, c);
-                        iList.erase(iList.begin() + i);
-                        break; 
-                    }
-                }
+        size_t count = 0, remaining = S, misses = 0, i = 0;
+
+        while (remaining > 3){
+            // after a whole lap without an ear the polygon is not simple, clip anyway so this terminates
+            if (!isEar(i) && misses < remaining){
+                ++misses;
+                i = next[i];
+                continue;
             }
+
+            triangles[count++] = Vector3(prev[i], i, next[i]);
+
+            next[prev[i]] = next[i];
+            prev[next[i]] = prev[i];
+            --remaining;
+            misses = 0;
+
+            updateReflex(prev[i]);
+            updateReflex(next[i]);
+            i = next[i];
         }
 
-        triangles[V - 1] = Vector3(iList[0], iList[1], iList[2]);
+        triangles[count] = Vector3(prev[i], i, next[i]);
 
         return triangles;
     }
 
-    /* should be inlined in the future */
-    float crossProduct(Vector2 a, Vector2 b){
-        return (float)a.a * (float)b.b - (float)a.a * (float)b.b;
+    /* z component of the cross product, twice the signed area of the triangle 0, a, b */
+    static int64_t crossProduct(Vector2 a, Vector2 b){
+        return (int64_t)a.a * b.b - (int64_t)a.b * b.a;
     }
 
-    /* implements a circular method for indexing items from a vector */
-    template<typename T>
-    T& getItem(std::vector<T>& arr, int64_t i){
-        if ((int64_t)i >= (int64_t)arr.size())
-            return arr[i % arr.size()]; else
-        if (i < 0)
-            return arr[arr.size() - std::abs(i)];
-        else
-            return arr[i];
+    /* positive for one direction of turning at b, negative for the other, 0 if a, b and c are collinear */
+    static int64_t turn(Vector2 a, Vector2 b, Vector2 c){
+        return crossProduct(b - a, c - b);
     }
 
-    /* if point P is inside tri ABC */
-    bool pointInTriangle(Vector2 p, Vector2 a, Vector2 b, Vector2 c){
-        auto triArea = [](const Point& a, const Point& b, const Point& c){
-            return std::abs((float)a.x * ((float)b.y - (float)c.y) + (float)b.x * ((float)c.y - (float)a.y) + (float)c.x * ((float)a.y - (float)b.y)) / 0.5f;
-        };
-
-        float area = triArea(a, b, c);
-        float areaPAB = triArea(p, a, b);
-        float areaPBC = triArea(p, b, c);
-        float areaPCA = triArea(p, c, a);
+    /* if point P is inside or on the edge of tri ABC, which winds in the direction given by winding, but not one of its corners */
+    static bool pointInTriangle(Vector2 p, Vector2 a, Vector2 b, Vector2 c, int64_t winding){
+        if ((p.a == a.a && p.b == a.b) || (p.a == b.a && p.b == b.b) || (p.a == c.a && p.b == c.b))
+            return false;
 
-        return (float)areaPAB + (float)areaPBC + (float)areaPCA == (float)area;
+        return turn(a, b, p) * winding >= 0 && turn(b, c, p) * winding >= 0 && turn(c, a, p) * winding >= 0;
     }
 
 /* filled triangle helper functions */
 private:
     void fillFlatBottom(const Point2d& a, const Point2d& b, const Point2d& c){
+    #ifdef USE_FIXED_POINT_RASTER
+        fillFlat(a, a, c, b, a.y, c.y, a.c);
+    #else
         const float lSlope = ((float)c.x - (float)a.x) / ((float)c.y - (float)a.y);
         const float rSlope = ((float)b.x - (float)a.x) / ((float)b.y - (float)a.y);
 
@@ -419,10 +984,15 @@ private:
         const float rDiffG = (float)b.g - (float)a.g;
         const float rDiffB = (float)b.b - (float)a.b;
 
+        // depth is linear in screen space, so it can be interpolated by height alone
+        const float height = (float)c.y - (float)a.y;
+        const float lDiffZ = (c.z - a.z) / height;
+        const float rDiffZ = (b.z - a.z) / height;
+
         for (uint16_t y = a.y; y <= c.y; ++y){
 
-            const uint8_t lX = (float)a.x + (float)(y - a.y) * (float)lSlope;
-            const uint8_t rX = (float)a.x + (float)(y - a.y) * (float)rSlope;
+            const int16_t lX = (float)a.x + (float)(y - a.y) * (float)lSlope;
+            const int16_t rX = (float)a.x + (float)(y - a.y) * (float)rSlope;
 
             const float lLerpFactor = sqrtf((float)pow((float)lX - (float)a.x, 2) + (float)pow((float)y - (float)a.y, 2)) / (float)lDistance;
             const float rLerpFactor = sqrtf((float)pow((float)rX - (float)a.x, 2) + (float)pow((float)y - (float)a.y, 2)) / (float)rDistance;
@@ -431,17 +1001,23 @@ private:
                 (uint8_t)((float)a.r + ((float)lLerpFactor * (float)lDiffR)),
                 (uint8_t)((float)a.g + ((float)lLerpFactor * (float)lDiffG)),
                 (uint8_t)((float)a.b + ((float)lLerpFactor * (float)lDiffB)),
-                lX, y, a.c
+                lX, y, a.c,
+                a.z + (float)(y - a.y) * lDiffZ
             }, {
                 (uint8_t)((float)a.r + ((float)rLerpFactor * (float)rDiffR)),
                 (uint8_t)((float)a.g + ((float)rLerpFactor * (float)rDiffG)),
                 (uint8_t)((float)a.b + ((float)rLerpFactor * (float)rDiffB)),
-                rX, y, a.c
+                rX, y, a.c,
+                a.z + (float)(y - a.y) * rDiffZ
             });
         }
+    #endif
     }
 
     void fillFlatTop(const Point2d& a, const Point2d& b, const Point2d& c){
+    #ifdef USE_FIXED_POINT_RASTER
+        fillFlat(c, b, a, a, c.y, a.y, a.c);
+    #else
         const float lSlope = ((float)a.x - (float)c.x) / ((float)a.y - (float)c.y);
         const float rSlope = ((float)a.x - (float)b.x) / ((float)a.y - (float)b.y);
 
@@ -456,10 +1032,15 @@ private:
         const float rDiffG = (float)b.g - (float)a.g;
         const float rDiffB = (float)b.b - (float)a.b;
 
+        // depth is linear in screen space, so it can be interpolated by height alone
+        const float height = (float)a.y - (float)c.y;
+        const float lDiffZ = (a.z - c.z) / height;
+        const float rDiffZ = (a.z - b.z) / height;
+
         for (uint16_t y = c.y; y <= a.y; ++y){
 
-            const uint8_t lX = (float)c.x + (float)(y - c.y) * (float)lSlope;
-            const uint8_t rX = (float)b.x + (float)(y - c.y) * (float)rSlope;
+            const int16_t lX = (float)c.x + (float)(y - c.y) * (float)lSlope;
+            const int16_t rX = (float)b.x + (float)(y - c.y) * (float)rSlope;
 
             const float lLerpFactor = sqrtf((float)pow((float)lX - (float)a.x, 2) + (float)pow((float)a.y - (float)y, 2)) / (float)lDistance;
             const float rLerpFactor = sqrtf((float)pow((float)rX - (float)a.x, 2) + (float)pow((float)a.y - (float)y, 2)) / (float)rDistance;
@@ -468,20 +1049,229 @@ private:
                 (uint8_t)((float)a.r + ((float)lLerpFactor * (float)lDiffR)),
                 (uint8_t)((float)a.g + ((float)lLerpFactor * (float)lDiffG)),
                 (uint8_t)((float)a.b + ((float)lLerpFactor * (float)lDiffB)),
-                lX, y, a.c
+                lX, y, a.c,
+                c.z + (float)(y - c.y) * lDiffZ
             }, {
                 (uint8_t)((float)a.r + ((float)rLerpFactor * (float)rDiffR)),
                 (uint8_t)((float)a.g + ((float)rLerpFactor * (float)rDiffG)),
                 (uint8_t)((float)a.b + ((float)rLerpFactor * (float)rDiffB)),
-                rX, y, a.c
+                rX, y, a.c,
+                b.z + (float)(y - c.y) * rDiffZ
+            });
+        }
+    #endif
+    }
+
+#ifdef USE_FIXED_POINT_RASTER
+    /*
+        rows from y0 to y1 between the left edge l0 -> l1 and the right edge r0 -> r1,
+        edge positions and colors are stepped once per row in 16.16 fixed point
+    */
+    void fillFlat(const Point2d& l0, const Point2d& r0, const Point2d& l1, const Point2d& r1, int32_t y0, int32_t y1, char c){
+        const int32_t height = y1 - y0;
+
+        // the half pixel added up front makes the shift round to the nearest pixel
+        int32_t lX = l0.x * 65536 + 32768;
+        int32_t rX = r0.x * 65536 + 32768;
+        const int32_t lStep = height ? (int32_t)(((int64_t)l1.x - l0.x) * 65536 / height) : 0;
+        const int32_t rStep = height ? (int32_t)(((int64_t)r1.x - r0.x) * 65536 / height) : 0;
+
+        Span::Gradient l = Span::Gradient::between(l0, l1, height + 1);
+        Span::Gradient r = Span::Gradient::between(r0, r1, height + 1);
+
+        // depth is linear in screen space, so it can be interpolated by height alone
+        const float lDiffZ = height ? (l1.z - l0.z) / (float)height : 0.0f;
+        const float rDiffZ = height ? (r1.z - r0.z) / (float)height : 0.0f;
+
+        for (int32_t y = y0; y <= y1; ++y){
+            drawXLine({
+                Span::channel(l.r), Span::channel(l.g), Span::channel(l.b),
+                lX >> 16, y, c,
+                l0.z + (float)(y - y0) * lDiffZ
+            }, {
+                Span::channel(r.r), Span::channel(r.g), Span::channel(r.b),
+                rX >> 16, y, c,
+                r0.z + (float)(y - y0) * rDiffZ
             });
+
+            lX += lStep; rX += rStep;
+            l.step(); r.step();
+        }
+    }
+#endif
+
+/* edge function rasterizer */
+private:
+    static constexpr int32_t TILE_SIZE = 8;
+
+    /* an attribute that varies linearly over the triangle: v(x, y) = v + (x - x0) * dx + (y - y0) * dy */
+    struct Plane {
+        float v, dx, dy;
+        int32_t x0, y0;
+
+        float at(int32_t x, int32_t y) const {
+            return v + (float)(x - x0) * dx + (float)(y - y0) * dy;
+        }
+    };
+
+    /* E(x, y) = A * x + B * y + C is >= 0 on the inside of the edge, the fill rule bias is folded into C */
+    struct Edge {
+        int64_t A, B, C;
+
+        int64_t at(int64_t x, int64_t y) const {
+            return A * x + B * y + C;
+        }
+    };
+
+    /*
+        fills triangle abc, only touching pixels inside clip
+        tiles that are completely outside an edge are skipped, tiles that are completely inside all edges
+        are filled without per-pixel edge tests
+    */
+    void rasterTri(const Point2d& a, Point2d b, Point2d c, const Rect& clip){
+        int64_t area = ((int64_t)b.x - a.x) * ((int64_t)c.y - a.y) - ((int64_t)b.y - a.y) * ((int64_t)c.x - a.x);
+
+        if (area == 0) return;
+        if (area < 0){ std::swap(b, c); area = -area; }
+
+        // edges[i] is the edge opposite of vertex i, so edges[i] / area is the barycentric weight of vertex i
+        const Edge edges[3] = { makeEdge(b, c), makeEdge(c, a), makeEdge(a, b) };
+
+        const int32_t minX = std::max<int32_t>(std::min({a.x, b.x, c.x}), clip.x0);
+        const int32_t maxX = std::min<int32_t>(std::max({a.x, b.x, c.x}), clip.x1);
+        const int32_t minY = std::max<int32_t>(std::min({a.y, b.y, c.y}), clip.y0);
+        const int32_t maxY = std::min<int32_t>(std::max({a.y, b.y, c.y}), clip.y1);
+
+        if (minX > maxX || minY > maxY) return;
+
+        const float invArea = 1.0f / (float)area;
+
+        auto makePlane = [&](float va, float vb, float vc){
+            return Plane {
+                va,
+                ((float)edges[0].A * va + (float)edges[1].A * vb + (float)edges[2].A * vc) * invArea,
+                ((float)edges[0].B * va + (float)edges[1].B * vb + (float)edges[2].B * vc) * invArea,
+                a.x, a.y
+            };
+        };
+
+        const Plane planes[4] = {
+            makePlane(a.r, b.r, c.r),
+            makePlane(a.g, b.g, c.g),
+            makePlane(a.b, b.b, c.b),
+            makePlane(a.z, b.z, c.z)
+        };
+
+        // tiles are aligned to the screen so neighbouring triangles share them
+        for (int32_t ty = minY - minY % TILE_SIZE; ty <= maxY; ty += TILE_SIZE){
+            const int32_t y0 = std::max(ty, minY);
+            const int32_t y1 = std::min(ty + TILE_SIZE - 1, maxY);
+
+            for (int32_t tx = minX - minX % TILE_SIZE; tx <= maxX; tx += TILE_SIZE){
+                const int32_t x0 = std::max(tx, minX);
+                const int32_t x1 = std::min(tx + TILE_SIZE - 1, maxX);
+
+                bool outside = false;
+                bool covered = true;
+
+                for (const Edge& e : edges){
+                    // E is linear, so its extremes over the tile are at the corners
+                    const int64_t e00 = e.at(x0, y0), e10 = e.at(x1, y0);
+                    const int64_t e01 = e.at(x0, y1), e11 = e.at(x1, y1);
+
+                    if (std::max({e00, e10, e01, e11}) < 0){ outside = true; break; }
+                    if (std::min({e00, e10, e01, e11}) < 0) covered = false;
+                }
+
+                if (outside)
+                    continue;
+
+                if (covered)
+                    rasterTile<true>(edges, planes, a.c, x0, y0, x1, y1);
+                else
+                    rasterTile<false>(edges, planes, a.c, x0, y0, x1, y1);
+            }
+        }
+    }
+
+    template<bool Covered>
+    void rasterTile(const Edge* edges, const Plane* planes, char c, int32_t x0, int32_t y0, int32_t x1, int32_t y1){
+        int64_t w0Row = edges[0].at(x0, y0);
+        int64_t w1Row = edges[1].at(x0, y0);
+        int64_t w2Row = edges[2].at(x0, y0);
+
+        float rRow = planes[0].at(x0, y0);
+        float gRow = planes[1].at(x0, y0);
+        float bRow = planes[2].at(x0, y0);
+        float zRow = planes[3].at(x0, y0);
+
+        uint64_t covered = Covered ? (uint64_t)(x1 - x0 + 1) * (y1 - y0 + 1) : 0;
+
+        for (int32_t y = y0; y <= y1; ++y){
+            Pixel* row = screen.row(y) + x0;
+            float* depth = screen.depthRow(y);
+            const uint32_t n = x1 - x0 + 1;
+
+            const Span::Gradient gradient = Span::Gradient::fromFloat(
+                rRow, gRow, bRow,
+                planes[0].dx, planes[1].dx, planes[2].dx,
+                c
+            );
+
+            if (Covered){
+                if (depth)
+                    Span::fillDepthTested(row, depth + x0, n, gradient, zRow, planes[3].dx);
+                else
+                    Span::fill(row, n, gradient);
+            }
+            else {
+                int64_t w0 = w0Row, w1 = w1Row, w2 = w2Row;
+                uint32_t r = gradient.r, g = gradient.g, b = gradient.b;
+                float z = zRow;
+
+                for (uint32_t i = 0; i < n; ++i){
+                    if ((w0 | w1 | w2) >= 0){
+                        ++covered;
+
+                        if (!depth || z >= depth[x0 + i]){
+                            if (depth) depth[x0 + i] = z;
+                            row[i] = Pixel(c, Span::channel(r), Span::channel(g), Span::channel(b));
+                        }
+                    }
+
+                    w0 += edges[0].A; w1 += edges[1].A; w2 += edges[2].A;
+                    r += gradient.dr; g += gradient.dg; b += gradient.db; z += planes[3].dx;
+                }
+            }
+
+            w0Row += edges[0].B; w1Row += edges[1].B; w2Row += edges[2].B;
+            rRow += planes[0].dy; gRow += planes[1].dy; bRow += planes[2].dy; zRow += planes[3].dy;
         }
+
+        PROFILE_COUNT(Pixels, covered);
+    }
+
+    /* edge p -> q, pixels exactly on the edge are only filled for top and left edges so shared edges are drawn once */
+    static Edge makeEdge(const Point2d& p, const Point2d& q){
+        const int64_t A = (int64_t)p.y - q.y;
+        const int64_t B = (int64_t)q.x - p.x;
+        const bool topLeft = A > 0 || (A == 0 && B > 0);
+
+        return { A, B, -(A * p.x + B * p.y) - (topLeft ? 0 : 1) };
     }
 
 public: /* text */
-    void putText(const std::string& TEXT, uint16_t X, uint16_t Y, const Pixel& P){
-        for (uint16_t i = 0; i < TEXT.length(); ++i)
-            screen[X + i][Y] = Pixel(TEXT[i], P.r, P.g, P.b);
+    void putText(std::string_view TEXT, uint16_t X, uint16_t Y, const Pixel& P){
+        if (X >= W || Y >= H)
+            return;
+
+        Pixel* row = screen.row(Y);
+        const size_t length = std::min<size_t>(TEXT.length(), W - X); // cut at the right edge
+
+        screen.markDirty(X, Y, X + (int32_t)length - 1, Y);
+
+        for (uint16_t i = 0; i < length; ++i)
+            row[X + i] = Pixel(TEXT[i], P.r, P.g, P.b);
     }
 
 private: /* resize helper functions */
@@ -519,39 +1309,57 @@ private: /* resize helper functions */
                 size.second = bufferInfo.srWindow.Right - bufferInfo.srWindow.Left + 1;
             }
         #else
-            io_write(1, "\033[18t", 6);
+            io_write(screen.output(), "\033[18t", 6);
 
             setRawMode(true);
 
-            std::string response;
+            // the reply is ESC [ 8 ; rows ; columns t
+            char response[32];
+            size_t length = 0;
             char ch;
-            while (read(STDIN_FILENO, &ch, 1) > 0) {
-                response += ch;
+            while (length < sizeof(response) - 1 && read(STDIN_FILENO, &ch, 1) > 0) {
+                response[length++] = ch;
                 if (ch == 't') break;
             }
+            response[length] = '\0';
 
             setRawMode(false);
 
-            std::size_t startPos = response.find('[');
-            std::size_t semicolonPos = response.find(';', startPos);
-            
-            if (startPos != std::string::npos && semicolonPos != std::string::npos) {
-                std::istringstream rowStream(response.substr(semicolonPos + 1));
-                rowStream >> size.first;
-
-                std::size_t secondSemicolonPos = response.find(';', semicolonPos + 1);
-                if (secondSemicolonPos != std::string::npos) {
-                    std::istringstream colStream(response.substr(secondSemicolonPos + 1));
-                    colStream >> size.second;
-                }
+            const char* rows = strchr(response, '[');
+            rows = rows ? strchr(rows, ';') : nullptr;
+
+            if (rows) {
+                char* end;
+                size.first = (uint16_t)strtoul(rows + 1, &end, 10);
+
+                if (*end == ';')
+                    size.second = (uint16_t)strtoul(end + 1, nullptr, 10);
             }
         #endif
         return size;
     }
 
 public:
+    /* follows the size of the terminal, offscreen windows keep their size */
     void resize(){
-        std::tie(H, W) = getTerminalSize();
+        if (screen.output() < 0)
+            return;
+
+        uint16_t rows, columns;
+        std::tie(rows, columns) = getTerminalSize();
+
+        W = columns / screen.cellColumns() * screen.cellWidth();
+        H = rows * screen.cellHeight();
+        screen.resize(W, H);
+        screen.setTerminalColumns(columns);
+
+        if (presenter)
+            presenter->setTerminalColumns(columns);
+    }
+
+    void resize(uint16_t width, uint16_t height){
+        W = width;
+        H = height;
         screen.resize(W, H);
     }
 
@@ -559,16 +1367,142 @@ public:
         screen.clear();
     }
 
+    /* color and glyph clear() fills the frame with */
+    void setClearPixel(const Pixel& p){
+        screen.setClearPixel(p);
+    }
+
+    /*
+        clear() only resets and an incremental refresh() only compares what was drawn to since the last frame,
+        every draw call reports its bounding box, so mostly static scenes cost little more than what moved
+    */
+    void setDirtyTracking(bool enable){
+        screen.setDirtyTracking(enable);
+    }
+
     void refresh(){
-        screen.present();
+        if (profilerOverlay)
+            drawProfilerOverlay();
+
+        // without an output nothing would see the escape codes
+        const bool encode = screen.output() >= 0 || encodeOffscreen;
+
+        if (sink)
+            sink->submit(screen);
+        else if (presenter && encode)
+            presenter->submit(screen);
+        else if (encode)
+            screen.present();
+
+        Profiler::endFrame();
+    }
+
+    /* encode OFFSCREEN frames on refresh anyway and throw the bytes away, to measure the encoder (see bench.cpp) */
+    void setEncodeOffscreen(bool enable){
+        encodeOffscreen = enable;
+    }
+
+    /* only re-send the cells that changed since the last refresh */
+    void setIncrementalRefresh(bool enable){
+        screen.setIncremental(enable);
+
+        if (presenter)
+            presenter->setIncremental(enable);
+    }
+
+    /* how pixels map to terminal cells, see Screen::setCellMode, the window keeps its size in pixels */
+    void setCellMode(CellMode mode){
+        screen.setCellMode(mode);
+
+        if (presenter)
+            presenter->setCellMode(mode);
+    }
+
+    /* for terminals without truecolor, see Screen::setColorMode */
+    void setColorMode(Palette::Mode mode, bool dither = false){
+        screen.setColorMode(mode, dither);
+
+        if (presenter)
+            presenter->setColorMode(mode, dither);
+    }
+
+    /*
+        encode and write frames on a separate thread, refresh() then only copies the frame and returns
+        DropOldest never stalls the caller, BlockOnFull keeps every frame but waits when the terminal falls behind
+    */
+    void setAsyncRefresh(bool enable, Presenter::Policy policy = Presenter::Policy::DropOldest){
+        presenter.reset();
+
+        if (enable){
+            presenter = std::make_unique<Presenter>(W, H, policy, screen.output());
+            presenter->setIncremental(screen.isIncremental());
+            presenter->setColorMode(screen.colorMode(), screen.isDithered());
+            presenter->setCellMode(screen.cellMode());
+            presenter->setTerminalColumns(screen.terminalWidth());
+        }
+    }
+
+    /* size of the last frame presented on this thread, 0 with async refresh or a sink */
+    size_t presentedBytes() const {
+        return presenter || sink ? 0 : screen.presentedBytes();
+    }
+
+public: /* render targets */
+    /* the pixels drawn so far, e.g. for Image::save after drawing into an OFFSCREEN window */
+    const Screen& frame() const {
+        return screen;
+    }
+
+    /*
+        hands every refreshed frame to sink instead of encoding it for the terminal (see FrameStream),
+        the sink is called on the thread that calls refresh(), nullptr goes back to the terminal
+    */
+    void setSink(FrameSink* sink){
+        this->sink = sink;
+    }
+
+public: /* profiling */
+    /* totals of the last refresh, all zero unless compiled with USE_PROFILER (see Profiler.cpp) */
+    const Profiler::FrameStats& frameStats() const {
+        return Profiler::lastFrame();
+    }
+
+    /* writes frameStats() over the top left corner before every refresh, only readable in CellMode::Char */
+    void setProfilerOverlay(bool enable){
+        profilerOverlay = enable;
+    }
+
+private:
+    bool profilerOverlay = false;
+
+    void drawProfilerOverlay(){
+        const Profiler::FrameStats& stats = Profiler::lastFrame();
+        const Pixel color(255, 255, 255);
+        char line[48];
+        uint16_t y = 0;
+
+        snprintf(line, sizeof(line), "frame       %7.3fms", stats.frameMs());
+        putText(line, 0, y++, color);
+
+        for (size_t i = 0; i < Profiler::STAGES; ++i){
+            const Profiler::Stage stage = (Profiler::Stage)i;
+            snprintf(line, sizeof(line), "%-11s %7.3fms", Profiler::name(stage), stats.ms(stage));
+            putText(line, 0, y++, color);
+        }
+
+        for (size_t i = 0; i < Profiler::COUNTERS; ++i){
+            const Profiler::Counter counter = (Profiler::Counter)i;
+            snprintf(line, sizeof(line), "%-11s %9llu", Profiler::name(counter), (unsigned long long)stats.count(counter));
+            putText(line, 0, y++, color);
+        }
     }
 
 private: /* struct definitions */
 
     struct Point {
-        uint16_t x, y;
+        int32_t x, y;
 
-        Point(uint16_t x, uint16_t y): x(x), y(y) {}
+        Point(int32_t x, int32_t y): x(x), y(y) {}
         Point(const Vector2& other): x(other.a), y(other.b) {}
         Point() = default;
         ~Point() = default;
@@ -593,7 +1527,7 @@ private: /* struct definitions */
         Vector2(const Point& other): a(other.x), b(other.y) {}
         Vector2(const Point2d& other): a(other.x), b(other.y) {}
 
-        Vector2 operator- (const Vector2& other){
+        Vector2 operator- (const Vector2& other) const {
             return Vector2((int32_t)a - (int32_t)other.a, (int32_t)b - (int32_t)other.b);
         }
     };
@@ -0,0 +1,263 @@
+#include "Renderer.cpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+
+/*
+    headless benchmark of the raster and present paths
+
+    build: g++ -std=c++17 -O2 bench.cpp -o bench -lpthread
+    run:   ./bench [threads] > before.csv
+
+    every scene is drawn through Window / Renderer at a few resolutions into a window without an output
+    that still encodes its frames (see Window::setEncodeOffscreen), exactly like for a terminal, but never writes them,
+    scenes only depend on a fixed seed, so the csv of two commits can be compared line by line
+
+    columns:
+        raster_ns_per_pixel  median time of clear + draw calls, divided by the pixels of the screen
+        triangles_per_s      triangles handed to the window per second of raster time
+        present_bytes_per_s  encoded bytes per second of refresh() time
+*/
+
+namespace {
+    constexpr uint32_t SEED = 0x9E3779B9;
+    constexpr size_t WARMUP_FRAMES = 3;
+    constexpr size_t MIN_FRAMES = 20;
+    constexpr uint64_t PIXELS_PER_RUN = 5'000'000; // frames per scene scale down with the resolution
+
+    constexpr std::pair<uint16_t, uint16_t> RESOLUTIONS[] = {
+        {80, 24}, {160, 48}, {320, 96}, {640, 192}
+    };
+
+    /* xorshift32, unlike the <random> distributions it gives the same numbers with every standard library */
+    struct Rng {
+        uint32_t state = SEED;
+
+        uint32_t next(){
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        }
+
+        /* in [lo, hi] */
+        int32_t range(int32_t lo, int32_t hi){
+            return lo + (int32_t)(next() % (uint32_t)(hi - lo + 1));
+        }
+
+        Point2d point(int32_t x, int32_t y){
+            const uint32_t rgb = next();
+            return { (uint8_t)rgb, (uint8_t)(rgb >> 8), (uint8_t)(rgb >> 16), x, y };
+        }
+    };
+
+    /* draws one frame, returns the number of triangles it handed to the window */
+    using Frame = std::function<uint64_t(Window&, Renderer&, size_t frame)>;
+
+    struct Scene {
+        const char* name;
+        Frame (*build)(uint16_t W, uint16_t H); // geometry is generated here, outside of the timed part
+    };
+
+    /* batch of triangles a few pixels across, per triangle overhead dominates */
+    Frame smallTriangles(uint16_t W, uint16_t H){
+        constexpr size_t COUNT = 4000;
+
+        Rng rng;
+        std::vector<Point2d> vertices;
+        std::vector<uint32_t> indices;
+
+        for (size_t i = 0; i < COUNT; ++i){
+            const int32_t x = rng.range(0, W - 1), y = rng.range(0, H - 1);
+            for (int k = 0; k < 3; ++k){
+                indices.push_back((uint32_t)vertices.size());
+                vertices.push_back(rng.point(x + rng.range(-3, 3), y + rng.range(-3, 3)));
+            }
+        }
+
+        return [=](Window& window, Renderer&, size_t){
+            window.drawTriangles(vertices.data(), indices.data(), COUNT, true);
+            return (uint64_t)COUNT;
+        };
+    }
+
+    /* a few triangles reaching past the screen edges, span filling and clipping dominate */
+    Frame hugeTriangles(uint16_t W, uint16_t H){
+        constexpr size_t COUNT = 8;
+
+        Rng rng;
+        std::vector<Point2d> vertices;
+        std::vector<uint32_t> indices;
+
+        for (size_t i = 0; i < 3 * COUNT; ++i){
+            indices.push_back((uint32_t)i);
+            vertices.push_back(rng.point(rng.range(-W / 2, W + W / 2), rng.range(-H / 2, H + H / 2)));
+        }
+
+        return [=](Window& window, Renderer&, size_t){
+            window.drawTriangles(vertices.data(), indices.data(), COUNT, true);
+            return (uint64_t)COUNT;
+        };
+    }
+
+    /* lines in every direction, some of them partly off screen */
+    Frame lines(uint16_t W, uint16_t H){
+        constexpr size_t COUNT = 2000;
+
+        Rng rng;
+        std::vector<Point2d> points;
+
+        for (size_t i = 0; i < 2 * COUNT; ++i)
+            points.push_back(rng.point(rng.range(-W / 8, W + W / 8), rng.range(-H / 8, H + H / 8)));
+
+        return [=](Window& window, Renderer&, size_t){
+            for (size_t i = 0; i < COUNT; ++i)
+                window.drawLine(points[2 * i], points[2 * i + 1]);
+            return (uint64_t)0;
+        };
+    }
+
+    /* filled hexagons through drawPoly, includes the triangulation */
+    Frame polygons(uint16_t W, uint16_t H){
+        constexpr size_t COUNT = 300;
+        constexpr float PI = 3.14159265f;
+
+        Rng rng;
+        std::vector<std::array<Point2d, 6>> polys(COUNT);
+
+        for (std::array<Point2d, 6>& poly : polys){
+            const int32_t x = rng.range(0, W - 1), y = rng.range(0, H - 1);
+            const float radius = (float)rng.range(2, std::max(2, H / 6));
+
+            for (int k = 0; k < 6; ++k)
+                poly[k] = rng.point(x + (int32_t)roundf(radius * cosf(k * PI / 3)), y + (int32_t)roundf(radius * sinf(k * PI / 3)));
+        }
+
+        return [=](Window& window, Renderer&, size_t){
+            for (const std::array<Point2d, 6>& p : polys)
+                window.drawPoly(true, p[0], p[1], p[2], p[3], p[4], p[5]);
+            return (uint64_t)(4 * COUNT);
+        };
+    }
+
+    /* nothing but the clear and the present of a full frame */
+    Frame clears(uint16_t, uint16_t){
+        return [](Window&, Renderer&, size_t){
+            return (uint64_t)0;
+        };
+    }
+
+    /* depth tested grid mesh through the whole Renderer pipeline: transform, projection, culling, raster */
+    Frame mesh(uint16_t W, uint16_t H){
+        constexpr uint32_t N = 32; // quads per side
+
+        Rng rng;
+        Mesh grid;
+        const float size = std::min(W, H) * 0.8f;
+
+        for (uint32_t j = 0; j <= N; ++j)
+            for (uint32_t i = 0; i <= N; ++i){
+                const Point2d c = rng.point(0, 0);
+                grid.vertices.push_back({
+                    c.r, c.g, c.b,
+                    (int16_t)(size * ((float)i / N - 0.5f)),
+                    (int16_t)(size * ((float)j / N - 0.5f)),
+                    (int16_t)rng.range(-2, 2)
+                });
+            }
+
+        for (uint32_t j = 0; j < N; ++j)
+            for (uint32_t i = 0; i < N; ++i){
+                const uint32_t v = j * (N + 1) + i;
+                grid.indices.insert(grid.indices.end(), { v, v + 1, v + N + 1, v + 1, v + N + 2, v + N + 1 });
+            }
+
+        grid.updateBounds();
+
+        return [=](Window&, Renderer& renderer, size_t frame){
+            renderer.setTransform(Mat4::rotationX(0.6f) * Mat4::rotationZ(0.05f * frame));
+            renderer.draw(grid, true);
+            return (uint64_t)grid.triangleCount();
+        };
+    }
+
+    constexpr Scene SCENES[] = {
+        { "small_triangles", smallTriangles },
+        { "huge_triangles", hugeTriangles },
+        { "lines", lines },
+        { "polygons", polygons },
+        { "clear", clears },
+        { "mesh", mesh }
+    };
+
+    using Clock = std::chrono::steady_clock;
+
+    uint64_t elapsedNs(Clock::time_point from, Clock::time_point to){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(to - from).count();
+    }
+
+    uint64_t median(std::vector<uint64_t>& values){
+        std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+        return values[values.size() / 2];
+    }
+
+    void run(const Scene& scene, uint16_t W, uint16_t H, unsigned threads){
+        Window window(W, H, Window::OFFSCREEN);
+        window.setEncodeOffscreen(true);
+        window.setDepthTest(true);
+        window.setThreads(threads);
+
+        Renderer renderer(window);
+        const Frame frame = scene.build(W, H);
+
+        const size_t frames = std::max<size_t>(MIN_FRAMES, PIXELS_PER_RUN / ((uint64_t)W * H));
+        std::vector<uint64_t> rasterNs, presentNs;
+        uint64_t triangles = 0, bytes = 0;
+
+        for (size_t i = 0; i < WARMUP_FRAMES + frames; ++i){
+            const Clock::time_point start = Clock::now();
+
+            window.clear();
+            const uint64_t drawn = frame(window, renderer, i);
+
+            const Clock::time_point drawnAt = Clock::now();
+
+            window.refresh();
+
+            const Clock::time_point end = Clock::now();
+
+            if (i < WARMUP_FRAMES)
+                continue;
+
+            rasterNs.push_back(elapsedNs(start, drawnAt));
+            presentNs.push_back(elapsedNs(drawnAt, end));
+            triangles += drawn;
+            bytes += window.presentedBytes();
+        }
+
+        const double raster = (double)median(rasterNs);
+        const double present = (double)median(presentNs);
+        const double trianglesPerFrame = (double)triangles / frames;
+        const double bytesPerFrame = (double)bytes / frames;
+
+        printf("%s,%u,%u,%u,%zu,%.3f,%.0f,%.0f,%.0f\n",
+            scene.name, W, H, threads, frames,
+            raster / ((double)W * H),
+            raster > 0 ? trianglesPerFrame * 1e9 / raster : 0.0,
+            bytesPerFrame,
+            present > 0 ? bytesPerFrame * 1e9 / present : 0.0
+        );
+        fflush(stdout);
+    }
+}
+
+int main(int argc, char** argv){
+    const unsigned threads = argc > 1 ? (unsigned)atoi(argv[1]) : 1;
+
+    printf("scene,width,height,threads,frames,raster_ns_per_pixel,triangles_per_s,present_bytes_per_frame,present_bytes_per_s\n");
+
+    for (const Scene& scene : SCENES)
+        for (const std::pair<uint16_t, uint16_t>& resolution : RESOLUTIONS)
+            run(scene, resolution.first, resolution.second, threads);
+}
@@ -0,0 +1,139 @@
+#define USE_ALLOCATION_COUNTER
+#include "Renderer.cpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+
+/*
+    checks that steady rendering makes no heap allocations once it is warmed up
+
+    build: g++ -std=c++17 -O2 check_alloc.cpp -o check_alloc -lpthread
+    run:   ./check_alloc
+
+    a scene that moves but keeps its shape is drawn through every path of Window / Renderer,
+    encoded like for a terminal and counted with USE_ALLOCATION_COUNTER (see Profiler.cpp),
+    prints every frame after the warm up that allocated and exits with 1 if there was one
+*/
+
+namespace {
+    constexpr int WARMUP_FRAMES = 10;
+    constexpr int FRAMES = 200;
+
+    struct Setup {
+        const char* name;
+        unsigned threads;
+        bool async;
+        CellMode cells;
+        Palette::Mode colors;
+    };
+
+    constexpr Setup SETUPS[] = {
+        { "sync", 1, false, CellMode::Square, Palette::Mode::TrueColor },
+        { "threads", 4, false, CellMode::Char, Palette::Mode::TrueColor },
+        { "async", 1, true, CellMode::HalfBlock, Palette::Mode::Xterm256 },
+        { "sextant", 2, false, CellMode::Sextant, Palette::Mode::Ansi16 }
+    };
+
+    Mesh grid(uint32_t n, float size){
+        Mesh mesh;
+        for (uint32_t j = 0; j <= n; ++j)
+            for (uint32_t i = 0; i <= n; ++i)
+                mesh.vertices.push_back({
+                    (uint8_t)(255 * i / n), (uint8_t)(255 * j / n), 128,
+                    (int16_t)(size * ((float)i / n - 0.5f)), (int16_t)(size * ((float)j / n - 0.5f)), 0
+                });
+
+        for (uint32_t j = 0; j < n; ++j)
+            for (uint32_t i = 0; i < n; ++i){
+                const uint32_t v = j * (n + 1) + i;
+                mesh.indices.insert(mesh.indices.end(), { v, v + 1, v + n + 1, v + 1, v + n + 2, v + n + 1 });
+            }
+
+        mesh.updateBounds();
+        return mesh;
+    }
+
+    /* returns the number of frames after the warm up that allocated */
+    int run(const Setup& setup){
+        Window window(160, 96, Window::OFFSCREEN);
+        window.setEncodeOffscreen(true);
+        window.setDepthTest(true);
+        window.setIncrementalRefresh(true);
+        window.setCellMode(setup.cells);
+        window.setColorMode(setup.colors, true);
+        window.setThreads(setup.threads);
+        // blocking hands every frame over, so the present thread warms up (front buffer) inside the warm up frames
+        window.setAsyncRefresh(setup.async, Presenter::Policy::BlockOnFull);
+        window.setProfilerOverlay(true);
+
+        Renderer renderer(window);
+        renderer.setCulling(Renderer::Culling::Back);
+        renderer.setTriangulationCache(true);
+
+        const Mesh mesh = grid(16, 60.0f);
+
+        std::array<Point3d, 8> cube = {
+            Point3d{255, 0, 0, -15, 15, 0}, Point3d{0, 255, 0, 15, 15, 0}, Point3d{255, 255, 0, 15, -15, 0}, Point3d{0, 0, 255, -15, -15, 0},
+            Point3d{255, 0, 255, -15, 15, 20}, Point3d{0, 255, 255, 15, 15, 20}, Point3d{255, 255, 255, 15, -15, 20}, Point3d{0, 0, 0, -15, -15, 20}
+        };
+
+        std::array<Point3d, 10> star;
+        for (int i = 0; i < 10; ++i){
+            const float radius = i % 2 ? 8.0f : 25.0f, angle = i * 3.14159265f / 5;
+            star[i] = { 200, 100, 50, (int16_t)(radius * cosf(angle)), (int16_t)(radius * sinf(angle)), 0 };
+        }
+
+        std::vector<Point2d> lines;
+        std::vector<uint32_t> lineIndices;
+        for (uint32_t i = 0; i < 64; ++i){
+            lines.push_back({ 255, (uint8_t)(4 * i), 0, (int32_t)(2 * i), 0 });
+            lines.push_back({ 0, (uint8_t)(4 * i), 255, 159 - (int32_t)(2 * i), 95 });
+            lineIndices.insert(lineIndices.end(), { 2 * i, 2 * i + 1 });
+        }
+
+        int failed = 0;
+
+        for (int frame = 0; frame < WARMUP_FRAMES + FRAMES; ++frame){
+            window.clear();
+
+            renderer.setTransform(Mat4::rotationX(0.6f) * Mat4::rotationZ(0.05f * frame));
+            renderer.draw(mesh, true);
+            renderer.draw(mesh, false);
+
+            renderer.setTransform(Mat4::rotationY(0.1f * frame));
+            renderer.renderRegObj<4>(Renderer::MeshKey{ 1, 0 }, cube.data(), true, 4, 0, 1, 5, 7, 3, 2, 6, 4, 0, 3, 7, 5, 1, 2, 6, 0, 1, 2, 3, 4, 5, 6, 7);
+            renderer.renderRegObj<4>(Renderer::MeshKey{ 1, 0 }, cube.data(), false, 4, 0, 1, 5, 7, 3, 2, 6, 4, 0, 3, 7, 5, 1, 2, 6, 0, 1, 2, 3, 4, 5, 6, 7);
+            renderer.renderRegObj<10>(Renderer::MeshKey{ 2, 0 }, star.data(), true, 0, 1, 2, 3, 4, 5, 6, 7, 8, 9);
+            renderer.renderFace(cube.data(), true, 0, 1, 2, 3);
+            renderer.render(Edge3d(cube[0], cube[6]));
+
+            window.setLineStyle(frame % 2 ? Window::LineStyle::Antialiased : Window::LineStyle::Aliased);
+            window.drawLines(lines.data(), lineIndices.data(), lineIndices.size() / 2);
+            window.drawPoly(true, Point2d(255, 0, 0, 10, 10), Point2d(0, 255, 0, 30, 5), Point2d(0, 0, 255, 50, 10), Point2d(255, 0, 0, 50, 30), Point2d(0, 255, 0, 30, 40));
+            window.putText("steady", 100, 90, Pixel(255, 255, 255));
+
+            window.refresh();
+
+            const uint64_t allocations = Profiler::lastFrame().count(Profiler::Counter::Allocations);
+            if (frame >= WARMUP_FRAMES && allocations){
+                printf("%s: frame %d made %llu allocation(s)\n", setup.name, frame, (unsigned long long)allocations);
+                ++failed;
+            }
+        }
+
+        return failed;
+    }
+}
+
+int main(){
+    int failed = 0;
+    for (const Setup& setup : SETUPS)
+        failed += run(setup);
+
+    if (failed){
+        printf("%d frame(s) allocated after the warm up\n", failed);
+        return 1;
+    }
+    printf("no allocations after the warm up\n");
+    return 0;
+}
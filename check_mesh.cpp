@@ -0,0 +1,152 @@
+#include "Renderer.cpp"
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+/*
+    regression checks for the mesh and face paths of the Renderer
+
+    build: g++ -std=c++17 -O2 -fsanitize=address,undefined check_mesh.cpp -o check_mesh -lpthread
+    run:   ./check_mesh
+
+    prints every failed check and exits with 1 if there was one
+*/
+
+namespace {
+    int failures = 0;
+
+    void check(bool ok, const char* what){
+        if (!ok){
+            printf("FAILED: %s\n", what);
+            ++failures;
+        }
+    }
+
+    using Triangle = std::array<uint32_t, 3>;
+
+    std::vector<Triangle> trianglesOf(const std::vector<uint32_t>& indices, size_t first, size_t last){
+        std::vector<Triangle> res;
+        for (size_t i = first; i < last; i += 3)
+            res.push_back({ indices[i], indices[i + 1], indices[i + 2] });
+        return res;
+    }
+
+    /* triangles with an index outside of the vertex buffer must not be walked and have to end up last, unchanged */
+    void vertexCacheWithBrokenTriangles(){
+        Mesh mesh(
+            { {255, 0, 0, 0, 0, 0}, {0, 255, 0, 10, 0, 0}, {0, 0, 255, 10, 10, 0}, {255, 255, 0, 0, 10, 0} },
+            { 0, 1, 2,  1, 2, 100000,  2, 3, 0,  3, 100001, 1,  1, 3, 2 }
+        );
+
+        mesh.optimizeVertexCache();
+
+        check(mesh.indices.size() == 15, "optimizeVertexCache keeps every triangle");
+
+        std::vector<Triangle> valid = trianglesOf(mesh.indices, 0, 9);
+        std::vector<Triangle> expected = { {0, 1, 2}, {2, 3, 0}, {1, 3, 2} };
+        std::sort(valid.begin(), valid.end());
+        std::sort(expected.begin(), expected.end());
+        check(valid == expected, "optimizeVertexCache reorders the valid triangles only");
+
+        const std::vector<Triangle> broken = trianglesOf(mesh.indices, 9, 15);
+        check(broken == std::vector<Triangle>({ {1, 2, 100000}, {3, 100001, 1} }), "optimizeVertexCache keeps broken triangles at the end, in order");
+    }
+
+    /* backface culling has to agree for filled faces, outlined faces and the same face as triangles, whatever the winding */
+    void cullingAgreesForEveryFaceKind(){
+        Window window(80, 60, Window::OFFSCREEN);
+        Renderer renderer(window);
+        renderer.setCulling(Renderer::Culling::Back);
+
+        // a convex quad and a concave L, both in each winding
+        std::array<Point3d, 4> quad = {
+            Point3d{255, 0, 0, -10, -10, 0}, Point3d{0, 255, 0, 10, -10, 0},
+            Point3d{0, 0, 255, 10, 10, 0}, Point3d{255, 255, 0, -10, 10, 0}
+        };
+        std::array<Point3d, 6> l = {
+            Point3d{255, 0, 0, -10, -10, 0}, Point3d{0, 255, 0, 10, -10, 0}, Point3d{0, 0, 255, 10, -5, 0},
+            Point3d{255, 255, 0, -5, -5, 0}, Point3d{0, 255, 255, -5, 10, 0}, Point3d{255, 0, 255, -10, 10, 0}
+        };
+
+        auto backfaces = [&](auto draw){
+            renderer.resetCullStats();
+            draw();
+            return renderer.cullStats().backfaces;
+        };
+
+        int culledWindings = 0;
+        for (int reversed = 0; reversed < 2; ++reversed){
+            auto q = [=](uint32_t i){ return reversed ? (4 - i) % 4 : i; };
+
+            const uint64_t filled = backfaces([&]{ renderer.renderRegObj<4>(quad.data(), true, q(0), q(1), q(2), q(3)); });
+            const uint64_t outline = backfaces([&]{ renderer.renderRegObj<4>(quad.data(), false, q(0), q(1), q(2), q(3)); });
+            const uint64_t triangles = backfaces([&]{ renderer.renderTriObj(quad.data(), true, q(0), q(1), q(2), q(0), q(2), q(3)); });
+
+            check(filled == 0 || filled == 2, "a filled quad is culled as a whole");
+            check((filled > 0) == (outline > 0), "filled and outlined quads cull the same");
+            check((filled > 0) == (triangles > 0), "filled quads and their triangles cull the same");
+            culledWindings += filled > 0;
+
+            auto e = [=](uint32_t i){ return reversed ? (6 - i) % 6 : i; };
+
+            const uint64_t filledL = backfaces([&]{ renderer.renderRegObj<6>(l.data(), true, e(0), e(1), e(2), e(3), e(4), e(5)); });
+            const uint64_t outlineL = backfaces([&]{ renderer.renderRegObj<6>(l.data(), false, e(0), e(1), e(2), e(3), e(4), e(5)); });
+
+            check(filledL == 0 || filledL == 4, "a filled concave face is culled as a whole");
+            check((filledL > 0) == (outlineL > 0), "filled and outlined concave faces cull the same");
+            check((filledL > 0) == (filled > 0), "concave and convex faces of the same winding cull the same");
+        }
+
+        check(culledWindings == 1, "exactly one winding is culled");
+    }
+
+    /* a cached split must not outlive the vertices it was made for, and the cache must stay within its bound */
+    void triangulationCacheFollowsTheMeshKey(){
+        Window cachedWindow(80, 60, Window::OFFSCREEN), freshWindow(80, 60, Window::OFFSCREEN);
+        Renderer cached(cachedWindow), fresh(freshWindow);
+        cached.setTriangulationCache(true, 8);
+
+        // an L whose notch moves to the opposite corner, the split of the first shape covers the notch of the second
+        std::array<Point3d, 6> l = {
+            Point3d{255, 0, 0, -20, -20, 0}, Point3d{0, 255, 0, 20, -20, 0}, Point3d{0, 0, 255, 20, -5, 0},
+            Point3d{255, 255, 0, -5, -5, 0}, Point3d{0, 255, 255, -5, 20, 0}, Point3d{255, 0, 255, -20, 20, 0}
+        };
+
+        auto sameFrame = [&](uint32_t generation){
+            cachedWindow.clear();
+            freshWindow.clear();
+            cached.renderRegObj<6>(Renderer::MeshKey{ 7, generation }, l.data(), true, 0, 1, 2, 3, 4, 5);
+            fresh.renderRegObj<6>(l.data(), true, 0, 1, 2, 3, 4, 5);
+            return cachedWindow.frame().data() == freshWindow.frame().data();
+        };
+
+        check(sameFrame(0), "a cached face draws like an uncached one");
+        check(sameFrame(0), "a face drawn from the cache draws like an uncached one");
+
+        l = {
+            Point3d{255, 0, 0, -20, -20, 0}, Point3d{0, 255, 0, 5, -20, 0}, Point3d{0, 0, 255, 5, 5, 0},
+            Point3d{255, 255, 0, 20, 5, 0}, Point3d{0, 255, 255, 20, 20, 0}, Point3d{255, 0, 255, -20, 20, 0}
+        };
+        check(sameFrame(1), "a new generation is split again");
+
+        for (uint32_t id = 0; id < 100; ++id)
+            cached.renderRegObj<6>(Renderer::MeshKey{ id, 0 }, l.data(), true, 0, 1, 2, 3, 4, 5);
+        check(cached.cachedFaces() <= 8, "the triangulation cache stays within its bound");
+
+        fresh.renderRegObj<6>(l.data(), true, 0, 1, 2, 3, 4, 5);
+        check(fresh.cachedFaces() == 0, "draw calls without a mesh key are not cached");
+    }
+}
+
+int main(){
+    vertexCacheWithBrokenTriangles();
+    cullingAgreesForEveryFaceKind();
+    triangulationCacheFollowsTheMeshKey();
+
+    if (failures){
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include "Screen.cpp"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+/*
+    regression checks for the terminal encoder of Screen
+
+    build: g++ -std=c++17 -O2 check_screen.cpp -o check_screen
+    run:   ./check_screen
+
+    frames are written to a pipe and read back, escape codes are followed like a terminal would,
+    prints every failed check and exits with 1 if there was one
+*/
+
+namespace {
+    int failures = 0;
+
+    void check(bool ok, const char* what){
+        if (!ok){
+            printf("FAILED: %s\n", what);
+            ++failures;
+        }
+    }
+
+    /* presents the screen into a pipe and returns what was written */
+    std::string presented(Screen& screen){
+        int fds[2];
+        if (pipe(fds) != 0){
+            perror("pipe");
+            exit(1);
+        }
+
+        screen.setOutput(fds[1]);
+        screen.present();
+        screen.setOutput(-1);
+        close(fds[1]);
+
+        std::string res;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+            res.append(buffer, (size_t)n);
+        close(fds[0]);
+        return res;
+    }
+
+    /* true if every glyph c is printed on the terminal's own background, following the SGR codes of output */
+    bool onDefaultBackground(const std::string& output, char c){
+        bool background = false; // a background color is set
+
+        for (size_t i = 0; i < output.size(); ++i){
+            if (output[i] == c && !background)
+                continue;
+            if (output[i] == c)
+                return false;
+            if (output[i] != '\033' || i + 1 >= output.size() || output[i + 1] != '[')
+                continue;
+
+            // parameters up to the final byte of the control sequence
+            size_t end = i + 2;
+            while (end < output.size() && !(output[end] >= '@' && output[end] <= '~'))
+                ++end;
+            if (end == output.size())
+                break;
+
+            if (output[end] == 'm'){
+                // the encoder writes one color per code, so the first parameter tells what it sets
+                const int code = atoi(output.substr(i + 2, end - i - 2).c_str());
+                if (code == 0 || code == 49)
+                    background = false;
+                else if ((code >= 40 && code <= 48) || (code >= 100 && code <= 107))
+                    background = true;
+            }
+            i = end;
+        }
+        return true;
+    }
+
+    /* Char cells only set the foreground, so a cell mode that sets backgrounds must not leave one behind */
+    void charAfterEveryCellMode(){
+        const CellMode modes[] = { CellMode::Square, CellMode::HalfBlock, CellMode::Quadrant, CellMode::Sextant };
+        const char* names[] = { "Square", "HalfBlock", "Quadrant", "Sextant" };
+
+        for (size_t m = 0; m < 4; ++m){
+            Screen screen(8, 6);
+            screen.setCellMode(modes[m]);
+
+            // busy colors so the block modes need both a foreground and a background
+            for (size_t i = 0; i < screen.data().size(); ++i)
+                screen.data()[i] = i % 2 ? Pixel(' ', 200, 0, 0) : Pixel(' ', 0, 0, 200);
+            std::string output = presented(screen);
+
+            screen.setCellMode(CellMode::Char);
+            for (Pixel& pixel : screen.data())
+                pixel = Pixel('x', 0, 255, 0);
+            output += presented(screen);
+
+            const std::string what = std::string("Char cells after a ") + names[m] + " frame are drawn on the terminal's background";
+            check(onDefaultBackground(output, 'x'), what.c_str());
+        }
+    }
+}
+
+int main(){
+    charAfterEveryCellMode();
+
+    if (failures){
+        printf("%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all checks passed\n");
+    return 0;
+}
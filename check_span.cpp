@@ -0,0 +1,106 @@
+#include "Span.cpp"
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <algorithm>
+#include <vector>
+
+/*
+    compares every span kernel the cpu supports with Span::fillScalar
+
+    build: g++ -std=c++17 -O2 check_span.cpp -o check_span
+    run:   ./check_span
+
+    random gradients (channels running past 0 and 255 included) are filled over spans of 0 to 64 pixels
+    starting at every offset within a 32 byte line, the pixels around the span must stay untouched,
+    prints every mismatch and exits with 1 if there was one
+*/
+
+namespace {
+    constexpr uint32_t MAX_SPAN = 64;
+    constexpr uint32_t OFFSETS = 8; // pixels, covers every 4 byte start within an AVX2 register
+    constexpr int ROUNDS = 2000;
+    constexpr uint32_t GUARD = 8;
+
+    const Pixel SENTINEL('#', 1, 2, 3);
+
+    struct Kernel {
+        const char* name;
+        Span::FillFunction fill;
+    };
+
+    std::vector<Kernel> supportedKernels(){
+        std::vector<Kernel> kernels;
+
+        #ifdef SPAN_X86_SIMD
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("sse2"))
+                kernels.push_back({ "fillSSE2", Span::fillSSE2 });
+            if (__builtin_cpu_supports("avx2"))
+                kernels.push_back({ "fillAVX2", Span::fillAVX2 });
+        #endif
+
+        kernels.push_back({ "fill", Span::fill }); // the dispatcher, with its short span cut off
+        return kernels;
+    }
+
+    Span::Gradient randomGradient(std::mt19937& rng){
+        // every third one goes through between() like the rasterizers, the rest use raw 16.16 values
+        if (rng() % 3 == 0){
+            const Point2d a((uint8_t)rng(), (uint8_t)rng(), (uint8_t)rng(), 0, 0, (char)('a' + rng() % 26));
+            const Point2d b((uint8_t)rng(), (uint8_t)rng(), (uint8_t)rng(), 0, 0);
+            return Span::Gradient::between(a, b, rng() % (MAX_SPAN + 1));
+        }
+
+        // starts a bit outside of 0..255 and steps of up to +-8 per pixel, so the clamping is exercised
+        auto start = [&]{ return (uint32_t)(((int32_t)(rng() % 320) - 32) * 65536 + (int32_t)(rng() % 65536)); };
+        auto step = [&]{ return (uint32_t)((int32_t)(rng() % (16 * 65536)) - 8 * 65536); };
+
+        return { start(), start(), start(), step(), step(), step(), (char)('a' + rng() % 26) };
+    }
+}
+
+int main(){
+    const std::vector<Kernel> kernels = supportedKernels();
+    std::mt19937 rng(7);
+
+    std::vector<Pixel> expected(OFFSETS + MAX_SPAN + GUARD), actual(expected.size());
+    uint64_t spans = 0, mismatches = 0;
+
+    for (int round = 0; round < ROUNDS; ++round){
+        const Span::Gradient grad = randomGradient(rng);
+
+        for (uint32_t n = 0; n <= MAX_SPAN; ++n)
+            for (uint32_t offset = 0; offset < OFFSETS; ++offset){
+                std::fill(expected.begin(), expected.end(), SENTINEL);
+                Span::fillScalar(expected.data() + offset, n, grad);
+
+                for (const Kernel& kernel : kernels){
+                    std::fill(actual.begin(), actual.end(), SENTINEL);
+                    kernel.fill(actual.data() + offset, n, grad);
+                    ++spans;
+
+                    for (size_t i = 0; i < actual.size(); ++i)
+                        if (actual[i] != expected[i]){
+                            if (++mismatches <= 20)
+                                printf("%s: span of %u at offset %u differs at pixel %d (rgb %u %u %u + %d %d %d)\n",
+                                    kernel.name, n, offset, (int)i - (int)offset,
+                                    grad.r, grad.g, grad.b, (int32_t)grad.dr, (int32_t)grad.dg, (int32_t)grad.db);
+                            break;
+                        }
+                }
+            }
+    }
+
+    printf("kernels:");
+    for (const Kernel& kernel : kernels)
+        printf(" %s", kernel.name);
+    printf("\n");
+
+    if (mismatches){
+        printf("%llu of %llu spans differ from fillScalar\n", (unsigned long long)mismatches, (unsigned long long)spans);
+        return 1;
+    }
+    printf("%llu spans match fillScalar\n", (unsigned long long)spans);
+    return 0;
+}
@@ -30,11 +30,10 @@ int main(){
 
         window.drawRect({255, 255, 255, 0, 0}, {255, 255, 255, (uint16_t)(window.width() - 1), (uint16_t)(window.height() - 1)}, false);
 
-        auto rotatedBuffer = Renderer::rotateYAxis(i, buffer);
-        auto rotatedTriBuffer = Renderer::rotateYAxis(i, triBuff);
+        renderer.setTransform(Mat4::rotationY(i));
 
         renderer.renderRegObj<4>(
-            rotatedBuffer.data(), false, 
+            buffer.data(), false, 
             4, 0, 1, 5,
             7, 3, 2, 6,
             4, 0, 3, 7,
@@ -43,7 +42,7 @@ int main(){
             4, 5, 6, 7
         );
 
-        renderer.renderTriObj(rotatedTriBuffer.data(), true, 
+        renderer.renderTriObj(triBuff.data(), true, 
             0, 1, 2
         );
 